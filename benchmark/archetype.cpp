@@ -0,0 +1,111 @@
+#include "inc/radiance.h"
+#include "inc/archetype.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+struct Position {
+  float x, y, z;
+};
+
+struct Velocity {
+  float x, y, z;
+};
+
+struct Health {
+  float hp;
+};
+
+typedef radiance::Archetype<uint32_t, Position> Static;
+typedef radiance::Archetype<uint32_t, Position, Velocity> Moving;
+typedef radiance::Archetype<uint32_t, Position, Velocity, Health> Living;
+
+const char kMainProgram[] = "main";
+
+void integrate(Position& p, Velocity& v) {
+  p.x += v.x;
+  p.y += v.y;
+  p.z += v.z;
+}
+
+void decay(Health& h) {
+  h.hp -= 0.01f;
+}
+
+double time_loop(uint64_t iterations) {
+  Timer timer;
+  double total = 0.0;
+  for (uint64_t i = 0; i < iterations; ++i) {
+    timer.start();
+    radiance::loop();
+    timer.stop();
+    total += timer.get_elapsed_ns();
+  }
+  return total / iterations;
+}
+
+int main() {
+  uint64_t count = 1 << 20;
+  uint64_t iterations = 50;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Number of iterations: " << iterations << std::endl;
+  std::cout << "Entity count per archetype: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+
+  Static statics(kMainProgram, "static");
+  Moving moving(kMainProgram, "moving");
+  Living living(kMainProgram, "living");
+  for (uint32_t i = 0; i < count; ++i) {
+    statics.insert(i, Position{(float)i, 0, 0});
+    moving.insert(count + i, Position{(float)i, 0, 0}, Velocity{1, 0, 0});
+    living.insert(2 * count + i, Position{(float)i, 0, 0}, Velocity{1, 0, 0},
+                  Health{100});
+  }
+
+  std::vector<radiance::Pipeline*> pipelines =
+      radiance::Query<Position, Velocity>::add_pipelines<integrate>(
+          kMainProgram, &statics, &moving, &living);
+  std::vector<radiance::Pipeline*> health =
+      radiance::Query<Health>::add_pipelines<decay>(
+          kMainProgram, &statics, &moving, &living);
+  pipelines.insert(pipelines.end(), health.begin(), health.end());
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  for (radiance::Pipeline* p : pipelines) {
+    radiance::enable_pipeline(p, policy);
+  }
+  radiance::start();
+
+  // Position + Velocity matches moving and living, Health only living.
+  uint64_t visited = moving.size() + 2 * living.size();
+  std::cout << "pipelines: " << pipelines.size() << std::endl;
+  double loop = time_loop(iterations);
+  std::cout << "avg ms per loop: " << loop / 1e6 << std::endl;
+  std::cout << "avg ns per visited entity: " << loop / visited << std::endl;
+
+  // Give a tenth of the moving entities health.
+  uint64_t migrated = count / 10;
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < migrated; ++i) {
+    Living::Value init;
+    radiance::get<Health>(init) = Health{50};
+    living.migrate(&moving, moving.table()->handle(0), init);
+  }
+  timer.stop();
+  std::cout << "migrate avg ns per entity: "
+            << timer.get_elapsed_ns() / migrated << std::endl;
+
+  loop = time_loop(iterations);
+  std::cout << "moving: " << moving.size() << ", living: " << living.size()
+            << std::endl;
+  std::cout << "avg ms per loop after migration: " << loop / 1e6 << std::endl;
+
+  radiance::stop();
+  return 0;
+}
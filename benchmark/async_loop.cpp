@@ -0,0 +1,143 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+#include <cmath>
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Transformations;
+
+const char kMainProgram[] = "main";
+
+radiance::Collection* add_transformations(Transformations::Table* table) {
+  radiance::Collection* c =
+      radiance::add_collection(kMainProgram, "transformations");
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Transformations::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Transformations::Element* el =
+            (Transformations::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Transformation(*(Transformation*)(value));
+      };
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Transformations::Table* t = (Transformations::Table*)c->collection;
+        Transformations::Element* el = (Transformations::Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Transformations::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Transformations::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Transformation);
+  c->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "transformations", "transformations");
+  pipeline->select = nullptr;
+  pipeline->transform = [](radiance::Stack* s) {
+    Transformations::Element* el = (Transformations::Element*)
+        ((radiance::Mutation*)(s->top()))->element;
+    for (int i = 0; i < 3; ++i) {
+      el->value.p[i] += el->value.v[i];
+    }
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  return c;
+}
+
+// Stands in for a renderer: reads every position a few times. Returns false
+// if the rows were not all from the same frame.
+bool consume(const Transformation* values, uint64_t count, float* checksum) {
+  float sum = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      sum += std::sqrt(values[i].p[0] + (float)j);
+    }
+  }
+  *checksum += sum;
+  for (uint64_t i = 1; i < count; ++i) {
+    if (values[i].p[0] != values[0].p[0]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  uint64_t count = 1 << 18;
+  uint64_t frames = 100;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+
+  Transformations::Table table;
+  for (uint64_t i = 0; i < count; ++i) {
+    table.insert((uint32_t)i, Transformation{{0, 0, 0}, {1, 0, 0}});
+  }
+  radiance::Collection* c = add_transformations(&table);
+  radiance::watch_collection(c);
+  radiance::start();
+
+  // Simulate, then consume the result, one after the other.
+  float checksum = 0;
+  bool consistent = true;
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < frames; ++i) {
+    radiance::loop();
+    consistent &= consume(table.values.data(), count, &checksum);
+  }
+  timer.stop();
+  double sync_ms = timer.get_elapsed_ns() / 1e6 / frames;
+  std::cout << "sync avg ms per frame: " << sync_ms << std::endl;
+
+  // Consume frame N while frame N + 1 is simulated.
+  uint64_t stale = 0;
+  timer.start();
+  radiance::Fence fence = radiance::loop_async();
+  radiance::wait_frame(fence);
+  for (uint64_t i = 0; i < frames; ++i) {
+    fence = radiance::loop_async();
+    radiance::ReadView view;
+    radiance::read_view(c, &view);
+    stale += fence - view.frame - 1;
+    consistent &= consume((const Transformation*)view.values, view.count,
+                          &checksum);
+    radiance::wait_frame(fence);
+  }
+  timer.stop();
+  double async_ms = timer.get_elapsed_ns() / 1e6 / (frames + 1);
+  std::cout << "async avg ms per frame: " << async_ms << std::endl;
+  std::cout << "throughput gain: " << (sync_ms / async_ms - 1) * 100 << "%"
+            << std::endl;
+  std::cout << "frames consistent: " << consistent
+            << ", views older than one frame: " << stale << std::endl;
+  std::cout << "checksum: " << checksum << std::endl;
+  radiance::stop();
+  return 0;
+}
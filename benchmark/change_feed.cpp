@@ -0,0 +1,182 @@
+#include "inc/radiance.h"
+#include "inc/change_feed.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Transformations;
+typedef radiance::ChangeFeed<Transformations::Table> TransformationFeed;
+
+const char kMainProgram[] = "main";
+
+radiance::Collection* add_transformations(Transformations::Table* table) {
+  radiance::Collection* c =
+      radiance::add_collection(kMainProgram, "transformations");
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Transformations::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Transformations::Element* el =
+            (Transformations::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Transformation(*(Transformation*)(value));
+      };
+  // Goes through update_at so that the feed sees the change.
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Transformations::Table* t = (Transformations::Table*)c->collection;
+        Transformations::Element* el = (Transformations::Element*)(m->element);
+        t->update_at(el->offset, std::move(el->value));
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Transformations::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Transformations::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Transformation);
+  c->values.offset = 0;
+
+  radiance::Pipeline* pipeline = radiance::add_pipeline(
+      kMainProgram, "transformations", "transformations");
+  // Only the bodies that are awake move.
+  pipeline->select = [](const uint8_t* values, uint64_t count,
+                        uint8_t* selected) {
+    const Transformation* t = (const Transformation*)values;
+    for (uint64_t i = 0; i < count; ++i) {
+      selected[i] = t[i].v[0] != 0;
+    }
+  };
+  pipeline->transform = [](radiance::Stack* s) {
+    Transformations::Element* el = (Transformations::Element*)
+        ((radiance::Mutation*)(s->top()))->element;
+    for (int i = 0; i < 3; ++i) {
+      el->value.p[i] += el->value.v[i];
+    }
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  return c;
+}
+
+int main() {
+  uint64_t count = 1 << 16;
+  uint64_t awake = count / 16;
+  uint64_t frames = 200;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Entity count: " << count << ", awake: " << awake << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+  radiance::set_execution_mode(radiance::ExecutionMode::DETERMINISTIC);
+
+  Transformations::Table table;
+  for (uint64_t i = 0; i < count; ++i) {
+    float v = i % (count / awake) == 0 ? 1.0f : 0.0f;
+    table.insert((uint32_t)i, Transformation{{0, 0, 0}, {v, 0, 0}});
+  }
+
+  TransformationFeed feed(&table);
+  radiance::Collection* c = add_transformations(&table);
+  c->publish = TransformationFeed::publish_collection;
+  c->feed = &feed;
+
+  // A replica kept up to date by a consumer thread, and a consumer that is
+  // too slow to keep up.
+  TransformationFeed::Subscriber* replica_subscriber =
+      feed.subscribe(count * 2);
+  TransformationFeed::Subscriber* slow_subscriber = feed.subscribe(awake * 4);
+  std::vector<Transformation> replica(count);
+  std::atomic<bool> running{true};
+  uint64_t polled = 0;
+  std::thread consumer([&] {
+    auto apply = [&replica](const TransformationFeed::Change& change) {
+      if (change.kind != TransformationFeed::Kind::CLEARED) {
+        replica[change.key] = change.value;
+      }
+    };
+    while (running.load(std::memory_order_relaxed)) {
+      uint64_t n = replica_subscriber->poll(apply);
+      polled += n;
+      if (n == 0) {
+        std::this_thread::yield();
+      }
+    }
+    polled += replica_subscriber->poll(apply);
+  });
+  radiance::start();
+
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < frames; ++i) {
+    radiance::loop();
+  }
+  timer.stop();
+  running = false;
+  consumer.join();
+
+  TransformationFeed::Stats stats = feed.stats();
+  std::cout << "feed frame ms: " << timer.get_elapsed_ns() / 1e6 / frames
+            << ", publish ns per frame: " << stats.publish_ns / frames
+            << std::endl;
+  std::cout << "changes: " << stats.changes << ", batches: " << stats.batches
+            << ", delivered: " << stats.delivered
+            << ", polled: " << polled << std::endl;
+  std::cout << "lost batches: " << replica_subscriber->lost()
+            << ", slow subscriber: " << slow_subscriber->lost()
+            << std::endl;
+
+  bool matches = true;
+  for (uint64_t i = 0; i < count; ++i) {
+    matches &= memcmp(&replica[table.key(i)], &table.value(i),
+                      sizeof(Transformation)) == 0;
+  }
+  std::cout << "replica matches: " << matches << std::endl;
+
+  // The same deltas found by comparing the whole table against a copy of the
+  // previous frame.
+  std::vector<Transformation> previous(table.values.begin(),
+                                       table.values.end());
+  uint64_t diffed = 0;
+  uint64_t diff_ns = 0;
+  Timer diff_timer;
+  for (uint64_t i = 0; i < frames; ++i) {
+    radiance::loop();
+    diff_timer.start();
+    for (uint64_t row = 0; row < table.size(); ++row) {
+      if (memcmp(&previous[row], &table.values[row],
+                 sizeof(Transformation)) != 0) {
+        previous[row] = table.values[row];
+        ++diffed;
+      }
+    }
+    diff_timer.stop();
+    diff_ns += diff_timer.get_elapsed_ns();
+  }
+  std::cout << "diff ns per frame: " << diff_ns / frames
+            << ", changes: " << diffed << std::endl;
+  radiance::stop();
+  return 0;
+}
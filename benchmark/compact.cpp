@@ -0,0 +1,157 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+#include <cstring>
+#include <vector>
+
+struct Particle {
+  float p[3];
+  float v[3];
+  float life;
+};
+
+typedef radiance::Schema<uint32_t, Particle> Particles;
+
+const char kMainProgram[] = "main";
+
+void add_particles(const char* name, Particles::Table* table) {
+  radiance::Collection* c = radiance::add_collection(kMainProgram, name);
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Particles::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Particles::Element* el = (Particles::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Particle(*(Particle*)(value));
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Particles::Table*)c->collection)->size();
+  };
+  c->load = radiance::load_table<Particles::Table>;
+  c->bind = radiance::bind_table<Particles::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Particle);
+  c->values.offset = 0;
+}
+
+int main() {
+  uint64_t count = 1 << 20;
+  uint64_t frames = 20;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Particle count: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+
+  // About half of the particles are alive.
+  Particles::Table particles;
+  for (uint64_t i = 0; i < count; ++i) {
+    float life = (float)((i * 2654435761u) % 100) - 50.0f;
+    particles.insert((uint32_t)i, Particle{{(float)i, 0, 0}, {1, 0, 0}, life});
+  }
+  Particles::Table alive;
+  add_particles("particles", &particles);
+  add_particles("alive", &alive);
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "particles", "alive");
+  pipeline->compact = true;
+  pipeline->select = [](const uint8_t* values, uint64_t count,
+                        uint8_t* selected) {
+    const Particle* p = (const Particle*)values;
+    for (uint64_t i = 0; i < count; ++i) {
+      selected[i] = p[i].life > 0;
+    }
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  radiance::start();
+
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < frames; ++i) {
+    radiance::loop();
+  }
+  timer.stop();
+  std::cout << "compaction ms per frame: "
+            << timer.get_elapsed_ns() / 1e6 / frames << std::endl;
+
+  // The same with one insert per live particle.
+  Particles::Table serial;
+  timer.start();
+  for (uint64_t i = 0; i < frames; ++i) {
+    serial.assign(nullptr, nullptr, 0);
+    for (uint64_t row = 0; row < particles.size(); ++row) {
+      if (particles.value(row).life > 0) {
+        serial.insert(particles.key(row), particles.value(row));
+      }
+    }
+  }
+  timer.stop();
+  std::cout << "serial inserts ms per frame: "
+            << timer.get_elapsed_ns() / 1e6 / frames << std::endl;
+
+  bool matches = alive.size() == serial.size();
+  for (uint64_t row = 0; matches && row < alive.size(); ++row) {
+    matches = alive.key(row) == serial.key(row) &&
+        memcmp(&alive.value(row), &serial.value(row), sizeof(Particle)) == 0 &&
+        alive.find(alive.key(row)) == alive.handle(row);
+  }
+  std::cout << "alive: " << alive.size() << ", matches: " << matches
+            << std::endl;
+
+  // Compacting into the source itself drops the dead particles. The live
+  // ones keep their handles, the handles of the dead ones go stale.
+  std::vector<radiance::Handle> handles;
+  std::vector<bool> live;
+  for (uint64_t row = 0; row < particles.size(); ++row) {
+    handles.push_back(particles.handle(row));
+    live.push_back(particles.value(row).life > 0);
+  }
+  radiance::disable_pipeline(pipeline);
+  radiance::Pipeline* in_place =
+      radiance::add_pipeline(kMainProgram, "particles", "particles");
+  in_place->compact = true;
+  in_place->select = pipeline->select;
+  enable_pipeline(in_place, policy);
+  radiance::loop();
+
+  bool handles_correct = particles.size() == alive.size();
+  for (uint64_t i = 0; i < handles.size(); ++i) {
+    const Particle* p = particles.get(handles[i]);
+    handles_correct &= live[i] ? p && p->life > 0 : !p;
+  }
+  std::cout << "in place: " << particles.size()
+            << ", handles correct: " << handles_correct << std::endl;
+
+  // A sink whose rows are not the shape of the source's cannot be compacted
+  // into.
+  radiance::disable_pipeline(in_place);
+  radiance::Collection* positions =
+      radiance::add_collection(kMainProgram, "positions");
+  positions->keys.size = sizeof(uint32_t);
+  positions->values.size = sizeof(float[3]);
+  radiance::Pipeline* mismatched =
+      radiance::add_pipeline(kMainProgram, "particles", "positions");
+  mismatched->compact = true;
+  std::cout << "mismatched sink rejected: "
+            << (enable_pipeline(mismatched, policy) ==
+                radiance::Status::INCOMPATIBLE_DATA_TYPES) << std::endl;
+  radiance::stop();
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/task.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <vector>
+
+// Build with `make cpp20`.
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Transformations;
+
+const char kMainProgram[] = "main";
+
+void add_transformations(Transformations::Table* table) {
+  radiance::Collection* c =
+      radiance::add_collection(kMainProgram, "transformations");
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Transformations::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Transformations::Element* el =
+            (Transformations::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Transformation(*(Transformation*)(value));
+      };
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Transformations::Table* t = (Transformations::Table*)c->collection;
+        Transformations::Element* el = (Transformations::Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Transformations::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Transformations::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Transformation);
+  c->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "transformations", "transformations");
+  pipeline->select = nullptr;
+  pipeline->transform = [](radiance::Stack* s) {
+    Transformations::Element* el = (Transformations::Element*)
+        ((radiance::Mutation*)(s->top()))->element;
+    for (int i = 0; i < 3; ++i) {
+      el->value.p[i] += el->value.v[i];
+    }
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+}
+
+// Breadth first search over a grid with walls, from one corner to the other.
+struct Search {
+  static const int kSize = 2048;
+  std::vector<uint8_t> walls;
+  std::vector<int32_t> distance;
+  std::vector<int32_t> frontier;
+  size_t next = 0;
+
+  Search() : walls(kSize * kSize), distance(kSize * kSize, -1) {
+    for (int i = 0; i < kSize * kSize; ++i) {
+      walls[i] = (i * 2654435761u) % 7 == 0;
+    }
+    walls[0] = 0;
+    distance[0] = 0;
+    frontier.push_back(0);
+  }
+
+  // Visits one cell. Returns false once there are none left.
+  bool step() {
+    if (next == frontier.size()) {
+      return false;
+    }
+    int32_t cell = frontier[next++];
+    int x = cell % kSize;
+    int y = cell / kSize;
+    const int dx[] = {1, -1, 0, 0};
+    const int dy[] = {0, 0, 1, -1};
+    for (int d = 0; d < 4; ++d) {
+      int nx = x + dx[d];
+      int ny = y + dy[d];
+      if (nx < 0 || ny < 0 || nx >= kSize || ny >= kSize) {
+        continue;
+      }
+      int32_t n = ny * kSize + nx;
+      if (!walls[n] && distance[n] < 0) {
+        distance[n] = distance[cell] + 1;
+        frontier.push_back(n);
+      }
+    }
+    return true;
+  }
+
+  int32_t result() const {
+    return distance[kSize * kSize - 1];
+  }
+};
+
+radiance::Task search(Search* s) {
+  uint32_t steps = 0;
+  while (s->step()) {
+    if (++steps % 1024 == 0) {
+      co_await radiance::next_slice();
+    }
+  }
+}
+
+// Runs frames until done() and returns the slowest one in ms.
+template<typename Done_>
+double worst_frame(Done_ done, uint64_t* frames) {
+  Timer timer;
+  double worst = 0;
+  *frames = 0;
+  while (!done()) {
+    timer.start();
+    radiance::loop();
+    timer.stop();
+    worst = std::max(worst, timer.get_elapsed_ns() / 1e6);
+    ++*frames;
+  }
+  return worst;
+}
+
+int main() {
+  uint64_t count = 1 << 16;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+
+  Transformations::Table table;
+  for (uint64_t i = 0; i < count; ++i) {
+    table.insert((uint32_t)i, Transformation{{0, 0, 0}, {1, 0, 0}});
+  }
+  add_transformations(&table);
+  radiance::start();
+
+  // The whole search in one frame.
+  Search inline_search;
+  radiance::Job* job = radiance::add_job();
+  job->state = &inline_search;
+  job->resume = [](radiance::Job* job, uint64_t) -> bool {
+    while (((Search*)job->state)->step()) {}
+    return true;
+  };
+  bool inline_done = false;
+  uint64_t frames;
+  double worst = worst_frame([&] {
+    bool done = inline_done;
+    inline_done = true;
+    return done;
+  }, &frames);
+  std::cout << "inline worst frame ms: " << worst << std::endl;
+
+  // The same search as a task with 1ms a frame.
+  Search spread_search;
+  radiance::spawn(search(&spread_search), 1000000);
+  worst = worst_frame([&] {
+    return spread_search.next == spread_search.frontier.size();
+  }, &frames);
+  std::cout << "task worst frame ms: " << worst << ", frames: " << frames
+            << std::endl;
+  std::cout << "results match: "
+            << (inline_search.result() == spread_search.result()) << std::endl;
+  radiance::stop();
+  return 0;
+}
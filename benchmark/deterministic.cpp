@@ -0,0 +1,155 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <glm/glm.hpp>
+#include <omp.h>
+
+struct Transformation {
+  glm::vec3 p;
+  glm::vec3 v;
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Transformations;
+
+const char kMainProgram[] = "main";
+
+radiance::Pipeline* add_transformations(uint64_t count) {
+  radiance::Collection* transformations =
+      radiance::add_collection(kMainProgram, "transformations");
+
+  Transformations::Table* table = new Transformations::Table();
+  table->keys.reserve(count);
+  table->values.reserve(count);
+
+  for (uint64_t i = 0; i < count; ++i) {
+    glm::vec3 p{(float)i, 0, 0};
+    glm::vec3 v{1, 0, 0};
+    table->insert(i, {p, v});
+  }
+
+  transformations->collection = (uint8_t*)table;
+  transformations->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Transformations::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Transformations::Element* el =
+            (Transformations::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Transformations::Value(
+            *(Transformations::Value*)(value) );
+      };
+  transformations->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Transformations::Table* t = (Transformations::Table*)c->collection;
+        Transformations::Element* el = (Transformations::Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  transformations->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Transformations::Table*)c->collection)->size();
+  };
+  transformations->load = [](radiance::Collection* c, const uint8_t* keys,
+                             const uint8_t* values, uint64_t count) {
+    Transformations::Table* t = (Transformations::Table*)c->collection;
+    t->assign((const Transformations::Key*)keys,
+              (const Transformations::Value*)values, count);
+    c->keys.data = (uint8_t*)t->keys.data();
+    c->values.data = (uint8_t*)t->values.data();
+  };
+
+  transformations->keys.data = (uint8_t*)table->keys.data();
+  transformations->keys.size = sizeof(Transformations::Key);
+  transformations->keys.offset = 0;
+  transformations->values.data = (uint8_t*)table->values.data();
+  transformations->values.size = sizeof(Transformations::Value);
+  transformations->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "transformations", "transformations");
+  pipeline->select = nullptr;
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  return pipeline;
+}
+
+// Moves every element one step.
+void integrate(radiance::Stack* s) {
+  Transformations::Element* el =
+      (Transformations::Element*)((radiance::Mutation*)(s->top()))->element;
+  el->value.p += el->value.v;
+}
+
+// Writes every element into its neighbor's slot, so the result depends on
+// whether the neighbor was read before or after it was written.
+void shift(radiance::Stack* s) {
+  Transformations::Element* el =
+      (Transformations::Element*)((radiance::Mutation*)(s->top()))->element;
+  el->value.p += el->value.v;
+  if (el->offset > 0) {
+    el->offset -= 1;
+  }
+}
+
+double time_loop(uint64_t iterations) {
+  Timer timer;
+  double total = 0.0;
+  for (uint64_t i = 0; i < iterations; ++i) {
+    timer.start();
+    radiance::loop();
+    timer.stop();
+    total += timer.get_elapsed_ns();
+  }
+  return total / iterations;
+}
+
+int main() {
+  uint64_t count = 1 << 20;
+  uint64_t iterations = 100;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Number of iterations: " << iterations << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+  radiance::Pipeline* pipeline = add_transformations(count);
+  radiance::start();
+
+  pipeline->transform = integrate;
+  radiance::set_execution_mode(radiance::ExecutionMode::FAST);
+  double fast = time_loop(iterations);
+  radiance::set_execution_mode(radiance::ExecutionMode::DETERMINISTIC);
+  double deterministic = time_loop(iterations);
+
+  std::cout << "fast avg ns per entity: " << fast / count << std::endl;
+  std::cout << "deterministic avg ns per entity: "
+            << deterministic / count << std::endl;
+  std::cout << "deterministic overhead: "
+            << 100.0 * (deterministic - fast) / fast << "%" << std::endl;
+
+  pipeline->transform = shift;
+  radiance::set_execution_mode(radiance::ExecutionMode::FAST);
+  int fast_mismatches = 0;
+  for (int i = 0; i < 10; ++i) {
+    fast_mismatches += radiance::verify_loop() == radiance::Status::NONDETERMINISTIC;
+  }
+  radiance::set_execution_mode(radiance::ExecutionMode::DETERMINISTIC);
+  int deterministic_mismatches = 0;
+  for (int i = 0; i < 10; ++i) {
+    deterministic_mismatches += radiance::verify_loop() == radiance::Status::NONDETERMINISTIC;
+  }
+  std::cout << "overlapping writes, nondeterministic frames out of 10: fast "
+            << fast_mismatches << ", deterministic "
+            << deterministic_mismatches << std::endl;
+
+  radiance::stop();
+  return 0;
+}
@@ -0,0 +1,145 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct Body {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint32_t, Body> Bodies;
+
+const char kMainProgram[] = "main";
+
+void add_bodies(Bodies::Table* table) {
+  radiance::Collection* c = radiance::add_collection(kMainProgram, "bodies");
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t* key, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Bodies::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Bodies::Element* el = (Bodies::Element*)(mutation->element);
+        el->offset = offset;
+        el->key = *(uint32_t*)key;
+        new (&el->value) Body(*(Body*)(value));
+      };
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Bodies::Table* t = (Bodies::Table*)c->collection;
+        Bodies::Element* el = (Bodies::Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Bodies::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Bodies::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Body);
+  c->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "bodies", "bodies");
+  pipeline->select = nullptr;
+
+  // Later rows take longer, so the workers finish at different times.
+  pipeline->transform = [](radiance::Stack* s) {
+    Bodies::Element* el =
+        (Bodies::Element*)((radiance::Mutation*)(s->top()))->element;
+    uint32_t steps = 1 + el->key / 4096;
+    for (uint32_t i = 0; i < steps; ++i) {
+      el->value.p[0] = std::sqrt(el->value.p[0] + el->value.v[0]);
+    }
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+}
+
+void run(const char* name, const radiance::ExecutorConfig& config,
+         Bodies::Table* table, uint64_t iterations) {
+  radiance::Universe uni;
+  uni.executor = config;
+  if (radiance::init(&uni) != radiance::Status::OK) {
+    std::cout << name << ": init failed" << std::endl;
+    return;
+  }
+  radiance::create_program(kMainProgram);
+  add_bodies(table);
+  radiance::start();
+
+  std::vector<double> latencies;
+  Timer timer;
+  for (uint64_t i = 0; i < iterations; ++i) {
+    timer.start();
+    radiance::loop();
+    timer.stop();
+    latencies.push_back(timer.get_elapsed_ns() / 1e3);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << name << " loop us p50: " << latencies[iterations / 2]
+            << ", p99: " << latencies[iterations * 99 / 100]
+            << ", max: " << latencies.back() << std::endl;
+
+  for (uint64_t w = 0; w < radiance::worker_count(); ++w) {
+    radiance::WorkerStats stats;
+    radiance::worker_stats(w, &stats);
+    double total = (double)(stats.busy_ns + stats.idle_ns);
+    std::cout << "  worker " << w << " cpu: " << stats.cpu
+              << ", utilization: " << (total > 0 ? stats.busy_ns / total : 0)
+              << ", migrations: " << stats.migrations << std::endl;
+  }
+  radiance::stop();
+}
+
+int main() {
+  uint64_t count = 1 << 16;
+  uint64_t iterations = 200;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  Bodies::Table table;
+  for (uint64_t i = 0; i < count; ++i) {
+    table.insert((uint32_t)i, Body{{1, 0, 0}, {1, 0, 0}});
+  }
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      cpus.push_back(cpu);
+    }
+  }
+
+  radiance::ExecutorConfig config;
+  run("openmp", config, &table, iterations);
+
+  config.cpus = cpus.data();
+  config.cpu_count = (uint32_t)cpus.size();
+  config.idle = radiance::IdleStrategy::SPIN;
+  run("pinned spin", config, &table, iterations);
+
+  config.idle = radiance::IdleStrategy::SPIN_THEN_PARK;
+  run("pinned spin then park", config, &table, iterations);
+
+  config.idle = radiance::IdleStrategy::PARK;
+  run("pinned park", config, &table, iterations);
+  return 0;
+}
@@ -0,0 +1,169 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Transformations;
+
+const char kMainProgram[] = "main";
+
+radiance::Pipeline* add_transformations(const char* name,
+                                        Transformations::Table* table,
+                                        radiance::Transform transform,
+                                        int16_t priority) {
+  radiance::Collection* c = radiance::add_collection(kMainProgram, name);
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Transformations::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Transformations::Element* el =
+            (Transformations::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Transformation(*(Transformation*)(value));
+      };
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Transformations::Table* t = (Transformations::Table*)c->collection;
+        Transformations::Element* el = (Transformations::Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Transformations::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Transformations::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Transformation);
+  c->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, name, name);
+  pipeline->select = nullptr;
+  pipeline->transform = transform;
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = priority;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  return pipeline;
+}
+
+// Moves every body one step.
+void move(radiance::Stack* s) {
+  Transformations::Element* el = (Transformations::Element*)
+      ((radiance::Mutation*)(s->top()))->element;
+  for (int i = 0; i < 3; ++i) {
+    el->value.p[i] += el->value.v[i];
+  }
+}
+
+// Something slow that can wait, e.g. updating effects. Counts the passes
+// over each row in p[0].
+void effects(radiance::Stack* s) {
+  Transformations::Element* el = (Transformations::Element*)
+      ((radiance::Mutation*)(s->top()))->element;
+  float x = el->value.p[1];
+  for (int i = 0; i < 32; ++i) {
+    x = std::sqrt(x + 1.0f);
+  }
+  el->value.p[1] = x;
+  el->value.p[0] += 1.0f;
+}
+
+void reset(Transformations::Table* table) {
+  for (auto& value : table->values) {
+    value = Transformation{{0, 0, 0}, {1, 0, 0}};
+  }
+}
+
+Transformations::Table* make_table(uint64_t count) {
+  Transformations::Table* table = new Transformations::Table();
+  for (uint64_t i = 0; i < count; ++i) {
+    table->insert((uint32_t)i, Transformation{{0, 0, 0}, {1, 0, 0}});
+  }
+  return table;
+}
+
+// Returns the p99 frame time in ms.
+double run_frames(uint64_t frames) {
+  std::vector<double> times;
+  Timer timer;
+  for (uint64_t i = 0; i < frames; ++i) {
+    timer.start();
+    radiance::loop();
+    timer.stop();
+    times.push_back(timer.get_elapsed_ns() / 1e6);
+  }
+  std::sort(times.begin(), times.end());
+  return times[frames * 99 / 100];
+}
+
+int main() {
+  uint64_t bodies = 1 << 16;
+  uint64_t particles = 1 << 18;
+  uint64_t frames = 200;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Bodies: " << bodies << ", particles: " << particles
+            << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+  Transformations::Table* body_table = make_table(bodies);
+  Transformations::Table* particle_table = make_table(particles);
+  add_transformations("bodies", body_table, move, radiance::MAX_PRIORITY);
+  add_transformations("particles", particle_table, effects,
+                      radiance::MIN_PRIORITY);
+  radiance::start();
+
+  double full_ms = run_frames(frames);
+  std::cout << "no budget p99 frame ms: " << full_ms << std::endl;
+
+  // Half of what a full frame takes.
+  reset(body_table);
+  reset(particle_table);
+  uint64_t budget_ns = (uint64_t)(full_ms * 1e6 / 2);
+  radiance::set_frame_budget(budget_ns, 0);
+  double budget_ms = run_frames(frames);
+  radiance::FrameStats stats = radiance::frame_stats();
+  std::cout << "budget ms: " << budget_ns / 1e6
+            << ", p99 frame ms: " << budget_ms << std::endl;
+  std::cout << "frames: " << stats.frames
+            << ", over budget: " << stats.over_budget
+            << ", skipped: " << stats.skipped
+            << ", deferred: " << stats.deferred << std::endl;
+
+  // Bodies ran every frame. Particles carried on where they stopped, so no
+  // particle is more than one pass ahead of another.
+  bool bodies_correct = true;
+  for (const auto& value : body_table->values) {
+    bodies_correct &= value.p[0] == (float)frames;
+  }
+  float fewest = particle_table->values[0].p[0];
+  float most = fewest;
+  for (const auto& value : particle_table->values) {
+    fewest = std::min(fewest, value.p[0]);
+    most = std::max(most, value.p[0]);
+  }
+  std::cout << "bodies correct: " << bodies_correct
+            << ", particle passes: " << fewest << " to " << most << std::endl;
+  radiance::stop();
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Transformations;
+
+const char kMainProgram[] = "main";
+
+// The table is not reserved up front. The collection's bind hook points the
+// pipelines at wherever the table's arrays are at the start of each run.
+radiance::Collection* add_transformations(Transformations::Table* table) {
+  radiance::Collection* c =
+      radiance::add_collection(kMainProgram, "transformations");
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Transformations::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Transformations::Element* el =
+            (Transformations::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Transformation(*(Transformation*)(value));
+      };
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Transformations::Table* t = (Transformations::Table*)c->collection;
+        Transformations::Element* el = (Transformations::Element*)(m->element);
+        t->update_at(el->offset, std::move(el->value));
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Transformations::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Transformations::Table>;
+  c->shrink = radiance::shrink_table<Transformations::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Transformation);
+  c->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "transformations", "transformations");
+  pipeline->select = nullptr;
+  pipeline->transform = [](radiance::Stack* s) {
+    Transformations::Element* el = (Transformations::Element*)
+        ((radiance::Mutation*)(s->top()))->element;
+    for (int i = 0; i < 3; ++i) {
+      el->value.p[i] += el->value.v[i];
+    }
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  return c;
+}
+
+uint64_t capacity_bytes(const Transformations::Table& table) {
+  return table.keys.capacity() * sizeof(uint32_t) +
+         table.values.capacity() * sizeof(Transformation);
+}
+
+int main() {
+  uint64_t count = 1 << 20;
+  uint64_t batch = 1 << 14;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+
+  Transformations::Table table;
+  std::vector<radiance::Handle> handles;
+  radiance::Collection* c = add_transformations(&table);
+  radiance::start();
+
+  // Grow the table between frames. Every entity moves one unit per loop()
+  // after the one it was inserted before.
+  Timer timer;
+  uint64_t frames = 0;
+  timer.start();
+  while (table.size() < count) {
+    for (uint64_t i = 0; i < batch; ++i) {
+      uint32_t key = (uint32_t)table.size();
+      handles.push_back(table.insert(key, Transformation{{0, 0, 0}, {1, 0, 0}}));
+    }
+    radiance::loop();
+    ++frames;
+  }
+  timer.stop();
+  std::cout << "avg ms per frame while growing: "
+            << timer.get_elapsed_ns() / 1e6 / frames << std::endl;
+
+  bool correct = true;
+  for (uint64_t i = 0; i < count; ++i) {
+    correct &= table[handles[i]].p[0] == (float)(frames - i / batch);
+  }
+  std::cout << "results correct: " << correct << std::endl;
+
+  // Drop nine in ten entities and give the memory back between frames.
+  for (uint64_t i = 0; i < count; ++i) {
+    if (i % 10 != 0) {
+      table.remove(handles[i]);
+    }
+  }
+  std::cout << "MiB before shrink: " << capacity_bytes(table) / (1 << 20)
+            << std::endl;
+  radiance::shrink_collection(c);
+  radiance::loop();
+  std::cout << "MiB after shrink: " << capacity_bytes(table) / (1 << 20)
+            << std::endl;
+
+  correct = true;
+  for (uint64_t i = 0; i < count; i += 10) {
+    correct &= table[handles[i]].p[0] == (float)(frames + 1 - i / batch);
+  }
+  std::cout << "results correct after shrink: " << correct << std::endl;
+
+  radiance::stop();
+  return 0;
+}
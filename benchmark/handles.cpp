@@ -0,0 +1,111 @@
+#include "inc/table.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <random>
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint64_t, Transformation> Transformations;
+
+int main() {
+  uint64_t count = 1 << 20;
+  uint64_t lookups = 1 << 22;
+  std::cout << "Entity count: " << count << std::endl;
+  std::cout << "Number of lookups: " << lookups << std::endl;
+
+  Transformations::Table table;
+  std::vector<radiance::Handle> handles;
+  std::vector<uint64_t> keys;
+  for (uint64_t i = 0; i < count; ++i) {
+    // Sparse keys, as entity ids usually are.
+    uint64_t key = i * 2654435761u;
+    handles.push_back(table.insert(key, Transformation{{(float)i, 0, 0}, {1, 0, 0}}));
+    keys.push_back(key);
+  }
+
+  // Churn so that slots are reused and generations move on.
+  for (uint64_t i = 0; i < count; i += 4) {
+    table.remove(handles[i]);
+    handles[i] = table.insert(keys[i], Transformation{{(float)i, 0, 0}, {1, 0, 0}});
+  }
+
+  std::mt19937_64 rng(0);
+  std::vector<uint64_t> order(lookups);
+  for (uint64_t& i : order) {
+    i = rng() % count;
+  }
+
+  Timer timer;
+  float sum = 0;
+
+  timer.start();
+  for (uint64_t i : order) {
+    sum += table[handles[i]].p[0];
+  }
+  timer.stop();
+  double unchecked = timer.get_elapsed_ns() / lookups;
+
+  timer.start();
+  for (uint64_t i : order) {
+    Transformation* t = table.get(handles[i]);
+    if (t) {
+      sum += t->p[0];
+    }
+  }
+  timer.stop();
+  double checked = timer.get_elapsed_ns() / lookups;
+
+  timer.start();
+  for (uint64_t i : order) {
+    sum += table[table.find(keys[i])].p[0];
+  }
+  timer.stop();
+  double by_key = timer.get_elapsed_ns() / lookups;
+
+  // A handle from before its element was removed must not alias the new one.
+  radiance::Handle stale = handles[1];
+  table.remove(stale);
+  radiance::Handle reused = table.insert(keys[1], Transformation{{0, 0, 0}, {0, 0, 0}});
+
+  bool stale_valid = table.valid(stale);
+  bool reused_valid = table.valid(reused);
+
+  // Replacing the contents keeps the handles of the keys that are still
+  // there. Stale handles and the handles of dropped keys must not come back.
+  std::vector<uint64_t> kept_keys;
+  std::vector<Transformation> kept_values;
+  for (uint64_t i = 2; i < count; i += 2) {
+    kept_keys.push_back(keys[i]);
+    kept_values.push_back(Transformation{{(float)i, 1, 0}, {0, 0, 0}});
+  }
+  kept_keys.push_back(1);
+  kept_values.push_back(Transformation{{-1, 0, 0}, {0, 0, 0}});
+  table.assign(kept_keys.data(), kept_values.data(), kept_keys.size());
+  bool kept_valid = true;
+  bool dropped_stale = true;
+  for (uint64_t i = 2; i < count; ++i) {
+    if (i % 2 == 0) {
+      kept_valid &= table.valid(handles[i]) && table[handles[i]].p[0] == i &&
+          table.find(keys[i]) == handles[i];
+    } else {
+      dropped_stale &= !table.valid(handles[i]);
+    }
+  }
+  dropped_stale &= !table.valid(stale) && !table.valid(handles[1]) &&
+      !table.valid(reused);
+
+  std::cout << "handle deref avg ns: " << unchecked << std::endl;
+  std::cout << "checked handle deref avg ns: " << checked << std::endl;
+  std::cout << "key lookup avg ns: " << by_key << std::endl;
+  std::cout << "stale handle valid: " << stale_valid
+            << ", reused handle valid: " << reused_valid << std::endl;
+  std::cout << "after assign, kept handles valid: " << kept_valid
+            << ", dropped and stale handles invalid: " << dropped_stale
+            << std::endl;
+  std::cout << "checksum: " << sum << std::endl;
+  return 0;
+}
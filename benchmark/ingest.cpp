@@ -0,0 +1,184 @@
+#include "inc/radiance.h"
+#include "inc/ingest.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+#include <atomic>
+#include <thread>
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Transformations;
+typedef radiance::Ingest<Transformations::Table> TransformationIngest;
+
+const char kMainProgram[] = "main";
+
+radiance::Collection* add_transformations(const char* name,
+                                          Transformations::Table* table) {
+  radiance::Collection* c = radiance::add_collection(kMainProgram, name);
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Transformations::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Transformations::Element* el =
+            (Transformations::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Transformation(*(Transformation*)(value));
+      };
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Transformations::Table* t = (Transformations::Table*)c->collection;
+        Transformations::Element* el = (Transformations::Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Transformations::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Transformations::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Transformation);
+  c->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, name, name);
+  pipeline->select = nullptr;
+  pipeline->transform = [](radiance::Stack* s) {
+    Transformations::Element* el = (Transformations::Element*)
+        ((radiance::Mutation*)(s->top()))->element;
+    for (int i = 0; i < 3; ++i) {
+      el->value.p[i] += el->value.v[i];
+    }
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  return c;
+}
+
+// Sets the velocity of entity i % count to i, as a network thread would.
+template<typename Push_>
+void produce(std::atomic<bool>* running, uint64_t count, Push_ push,
+             uint64_t* pushed) {
+  uint64_t i = 0;
+  while (running->load(std::memory_order_relaxed)) {
+    if (push(i % count, Transformation{{0, 0, 0}, {(float)i, 0, 0}})) {
+      ++i;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  *pushed = i;
+}
+
+int main() {
+  uint64_t count = 1 << 16;
+  uint64_t frames = 200;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+
+  Transformations::Table ring_table;
+  Transformations::Table queue_table;
+  for (uint64_t i = 0; i < count; ++i) {
+    ring_table.insert((uint32_t)i, Transformation{{0, 0, 0}, {0, 0, 0}});
+    queue_table.insert((uint32_t)i, Transformation{{0, 0, 0}, {0, 0, 0}});
+  }
+
+  // Room for about a frame of mutations from the producer.
+  TransformationIngest ingest(1 << 18);
+  radiance::Collection* c = add_transformations("ring", &ring_table);
+  c->merge = TransformationIngest::merge_collection;
+  c->ingest = &ingest;
+  radiance::start();
+
+  // A producer thread streams into its own ring, merged by loop().
+  std::atomic<bool> running{true};
+  uint64_t pushed = 0;
+  TransformationIngest::Producer* producer = ingest.add_producer();
+  std::thread thread([&] {
+    produce(&running, count, [producer](uint64_t offset, Transformation&& value) {
+      return producer->emplace<radiance::MutateBy::UPDATE,
+                               radiance::IndexedBy::OFFSET>(
+          (radiance::Offset)offset, std::move(value));
+    }, &pushed);
+  });
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < frames; ++i) {
+    radiance::loop();
+  }
+  running = false;
+  thread.join();
+  radiance::loop();
+  timer.stop();
+
+  TransformationIngest::Stats stats = ingest.stats();
+  double seconds = timer.get_elapsed_ns() / 1e9;
+  std::cout << "ring merged per second: " << stats.merged / seconds
+            << ", merge ns per mutation: "
+            << (double)stats.merge_ns / std::max<uint64_t>(stats.merged, 1)
+            << std::endl;
+  std::cout << "ring pushed: " << stats.pushed
+            << ", rejected: " << stats.rejected
+            << ", max batch: " << stats.max_batch
+            << ", all merged: " << (stats.merged == pushed) << std::endl;
+  radiance::stop();
+
+  // The same through a MutationBuffer, flushed by hand before each loop().
+  radiance::Universe queue_uni;
+  radiance::init(&queue_uni);
+  radiance::create_program(kMainProgram);
+  add_transformations("queue", &queue_table);
+  radiance::start();
+
+  Transformations::MutationBuffer buffer;
+  running = true;
+  thread = std::thread([&] {
+    produce(&running, count, [&buffer](uint64_t offset, Transformation&& value) {
+      buffer.emplace<radiance::MutateBy::UPDATE, radiance::IndexedBy::OFFSET>(
+          (radiance::Offset)offset, std::move(value));
+      return true;
+    }, &pushed);
+  });
+  uint64_t merged = 0;
+  uint64_t merge_ns = 0;
+  Timer merge_timer;
+  timer.start();
+  for (uint64_t i = 0; i <= frames; ++i) {
+    if (i == frames) {
+      running = false;
+      thread.join();
+    }
+    merge_timer.start();
+    merged += buffer.flush(&queue_table);
+    merge_timer.stop();
+    merge_ns += merge_timer.get_elapsed_ns();
+    radiance::loop();
+  }
+  timer.stop();
+  seconds = timer.get_elapsed_ns() / 1e9;
+  std::cout << "queue merged per second: " << merged / seconds
+            << ", merge ns per mutation: "
+            << (double)merge_ns / std::max<uint64_t>(merged, 1) << std::endl;
+  std::cout << "queue all merged: " << (merged == pushed) << std::endl;
+  radiance::stop();
+  return 0;
+}
@@ -49,7 +49,7 @@ int main() {
          radiance::Stack* stack) {
         radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
             sizeof(radiance::Mutation) + sizeof(Transformations::Element));
-        mutation->element = (uint8_t*)(mutation + sizeof(radiance::Mutation));
+        mutation->element = (uint8_t*)(mutation + 1);
         mutation->mutate_by = radiance::MutateBy::UPDATE;
         Transformations::Element* el =
             (Transformations::Element*)(mutation->element);
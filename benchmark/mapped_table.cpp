@@ -0,0 +1,89 @@
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <unistd.h>
+
+#include <vector>
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::MappedSchema<uint64_t, Transformation> Transformations;
+
+const char kTablePath[] = "mapped_table.bench";
+
+int main() {
+  uint64_t count = 1 << 20;
+  std::cout << "Entity count: " << count << std::endl;
+  unlink(kTablePath);
+
+  Timer timer;
+  std::vector<radiance::Handle> handles;
+  std::vector<uint64_t> keys;
+  {
+    // Starts small so that the file is grown and remapped along the way.
+    Transformations::Table table;
+    timer.start();
+    table.open(kTablePath, 1024);
+    for (uint64_t i = 0; i < count; ++i) {
+      uint64_t key = i * 2654435761u;
+      handles.push_back(
+          table.insert(key, Transformation{{(float)i, 0, 0}, {1, 0, 0}}));
+      keys.push_back(key);
+    }
+    timer.stop();
+    std::cout << "insert ns per entity: "
+              << timer.get_elapsed_ns() / count
+              << ", capacity: " << table.capacity() << std::endl;
+
+    timer.start();
+    table.checkpoint();
+    timer.stop();
+    std::cout << "checkpoint ms: " << timer.get_elapsed_ns() / 1e6
+              << std::endl;
+  }
+
+  Transformations::Table table;
+  timer.start();
+  table.open(kTablePath);
+  timer.stop();
+  std::cout << "reopen ms: " << timer.get_elapsed_ns() / 1e6 << std::endl;
+
+  // The first lookup by key builds the index.
+  timer.start();
+  bool found = table.size() == count;
+  for (uint64_t i = 0; found && i < count; ++i) {
+    radiance::Handle h = table.find(keys[i]);
+    found = h == handles[i] && table.get(h) && table.get(h)->p[0] == (float)i;
+  }
+  timer.stop();
+  std::cout << "find ns per entity: " << timer.get_elapsed_ns() / count
+            << ", all found: " << found << std::endl;
+
+  // Every other element is removed. Its handle goes stale and a new element
+  // that reuses its slot gets a different handle.
+  timer.start();
+  for (uint64_t i = 0; i < count; i += 2) {
+    table.remove(handles[i]);
+  }
+  timer.stop();
+  std::cout << "remove ns per entity: "
+            << timer.get_elapsed_ns() / (count / 2) << std::endl;
+
+  radiance::Handle reused = table.insert(1, Transformation{});
+  bool handles_correct = table.size() == count / 2 + 1 &&
+      table.remove(handles[0]) == -1 && table.find(keys[0]) == -1;
+  for (uint64_t i = 0; i < count; ++i) {
+    const Transformation* t = table.get(handles[i]);
+    handles_correct &= i % 2 ? t && t->p[0] == (float)i : !t;
+    handles_correct &= !(i % 2) || table.find(keys[i]) == handles[i];
+  }
+  handles_correct &= reused != handles[count - 2] && table.valid(reused);
+  std::cout << "handles correct: " << handles_correct << std::endl;
+
+  table.close();
+  unlink(kTablePath);
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include "inc/radiance.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <glm/glm.hpp>
+#include <omp.h>
+#include <unistd.h>
+
+#include <cstring>
+
+struct Transformation {
+  glm::vec3 p;
+  glm::vec3 v;
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Transformations;
+
+const char kLogPath[] = "mutation_log.bench";
+
+uint64_t scatter(const uint32_t& key, const Transformation&) {
+  return (key * 2654435761u) % 1000003;
+}
+
+// Pushes one update per entity and times only the flush, which is where the
+// mutations are logged.
+double run_frame(Transformations::Table* table,
+                 Transformations::MutationBuffer* buffer) {
+  for (uint64_t i = 0; i < table->size(); ++i) {
+    Transformations::Mutation m;
+    m.mutate_by = radiance::MutateBy::UPDATE;
+    m.el.indexed_by = radiance::IndexedBy::OFFSET;
+    m.el.offset = i;
+    m.el.value = table->values[i];
+    m.el.value.p += m.el.value.v;
+    buffer->push(std::move(m));
+  }
+
+  Timer timer;
+  timer.start();
+  buffer->flush(table);
+  timer.stop();
+  return timer.get_elapsed_ns();
+}
+
+double run(Transformations::Table* table, uint64_t frames,
+           Transformations::MutationLog* log) {
+  Transformations::MutationBuffer buffer;
+  if (log) {
+    buffer.set_log(log);
+  }
+
+  double total = 0.0;
+  for (uint64_t frame = 0; frame < frames; ++frame) {
+    total += run_frame(table, &buffer);
+    if (log) {
+      Timer timer;
+      timer.start();
+      log->end_frame(frame);
+      timer.stop();
+      total += timer.get_elapsed_ns();
+    }
+  }
+  return total;
+}
+
+int main() {
+  uint64_t count = 1000000;
+  uint64_t frames = 10;
+  std::cout << "Entity count: " << count << std::endl;
+  std::cout << "Number of frames: " << frames << std::endl;
+
+  Transformations::Table table;
+  table.keys.reserve(count);
+  table.values.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    glm::vec3 p{(float)i, 0, 0};
+    glm::vec3 v{1, 0, 0};
+    table.insert(i, {p, v});
+  }
+
+  double mutations = (double)count * frames;
+  double baseline = run(&table, frames, nullptr);
+  std::cout << "no log: " << baseline / mutations << " ns per mutation, "
+            << baseline / (mutations / 1e6) / 1e6 << " ms per million" << std::endl;
+
+  typedef Transformations::MutationLog::Sync Sync;
+  const std::pair<const char*, Sync> policies[] = {
+    {"sync none", Sync::NONE},
+    {"sync frame", Sync::FRAME},
+    {"sync commit", Sync::COMMIT},
+  };
+  for (const auto& policy : policies) {
+    unlink(kLogPath);
+    Transformations::MutationLog log;
+    log.open(kLogPath, policy.second);
+    double elapsed = run(&table, frames, &log);
+    std::cout << policy.first << ": "
+              << elapsed / mutations << " ns per mutation, "
+              << (elapsed - baseline) / (mutations / 1e6) / 1e6
+              << " ms overhead per million, "
+              << log.bytes_written() / mutations << " bytes per mutation"
+              << std::endl;
+  }
+  unlink(kLogPath);
+
+  // Updates by offset are logged by key, so replaying the log onto a snapshot
+  // reconstructs the table even though reorder() moved the rows in between.
+  Transformations::Table snapshot;
+  snapshot.assign(table.keys.data(), table.values.data(), table.size());
+  {
+    Transformations::MutationLog log;
+    log.open(kLogPath, Sync::NONE);
+    Transformations::MutationBuffer buffer;
+    buffer.set_log(&log);
+    for (uint64_t frame = 1; frame <= frames; ++frame) {
+      run_frame(&table, &buffer);
+      log.end_frame(frame);
+      table.set_locality(frame % 2 ? scatter : nullptr);
+      while (!table.reorder(1000000)) {}
+    }
+  }
+  Transformations::MutationLog::replay(kLogPath, &snapshot, 0, frames);
+  unlink(kLogPath);
+
+  bool matches = snapshot.size() == table.size();
+  for (uint64_t row = 0; matches && row < table.size(); ++row) {
+    const Transformation* t = snapshot.get(snapshot.find(table.key(row)));
+    matches = t && memcmp(t, &table.value(row), sizeof(Transformation)) == 0;
+  }
+  std::cout << "replay after snapshot and reorder matches: " << matches
+            << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+// Run under numactl to change the nodes that are used, e.g.
+//   OMP_PROC_BIND=spread numactl --cpunodebind=0,1 ./numa
+// or set RADIANCE_NUMA_NODES=2 to split the CPUs of a single node in two.
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Transformations;
+
+const char kMainProgram[] = "main";
+
+void add_transformations(Transformations::Table* table) {
+  radiance::Collection* c =
+      radiance::add_collection(kMainProgram, "transformations");
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Transformations::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Transformations::Element* el =
+            (Transformations::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Transformation(*(Transformation*)(value));
+      };
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Transformations::Table* t = (Transformations::Table*)c->collection;
+        Transformations::Element* el = (Transformations::Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Transformations::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Transformations::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Transformation);
+  c->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "transformations", "transformations");
+  pipeline->select = nullptr;
+  pipeline->transform = [](radiance::Stack* s) {
+    Transformations::Element* el = (Transformations::Element*)
+        ((radiance::Mutation*)(s->top()))->element;
+    for (int i = 0; i < 3; ++i) {
+      el->value.p[i] += el->value.v[i];
+    }
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+}
+
+double time_loop(uint64_t iterations) {
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < iterations; ++i) {
+    radiance::loop();
+  }
+  timer.stop();
+  return timer.get_elapsed_ns() / iterations;
+}
+
+int main() {
+  uint64_t count = 1 << 22;
+  uint64_t iterations = 20;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+  std::cout << "NUMA nodes: " << radiance::numa_nodes() << std::endl;
+
+  // Every page is first touched by this thread, so without placement all of
+  // the rows live on its node.
+  Transformations::Table table;
+  for (uint64_t i = 0; i < count; ++i) {
+    table.insert((uint32_t)i, Transformation{{0, 0, 0}, {1, 0, 0}});
+  }
+  add_transformations(&table);
+  radiance::start();
+
+  // The first loop() moves the rows to the nodes that run them.
+  Timer timer;
+  timer.start();
+  radiance::loop();
+  timer.stop();
+  std::cout << "first loop ms: " << timer.get_elapsed_ns() / 1e6 << std::endl;
+  std::cout << "avg ns per entity: " << time_loop(iterations) / count
+            << std::endl;
+
+  radiance::set_execution_mode(radiance::ExecutionMode::DETERMINISTIC);
+  std::cout << "deterministic avg ns per entity: "
+            << time_loop(iterations) / count << std::endl;
+
+  bool correct = true;
+  for (uint64_t i = 0; i < count; ++i) {
+    correct &= table.values[i].p[0] == (float)(2 * iterations + 1);
+  }
+  std::cout << "results correct: " << correct << std::endl;
+  radiance::stop();
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+struct Transformation {
+  float p[3];
+  float v[3];
+};
+
+typedef radiance::Schema<uint32_t, Transformation> Contiguous;
+typedef radiance::PagedSchema<uint32_t, Transformation> Paged;
+
+const char kMainProgram[] = "main";
+
+void integrate(radiance::Stack* s) {
+  Contiguous::Element* el =
+      (Contiguous::Element*)((radiance::Mutation*)(s->top()))->element;
+  for (int i = 0; i < 3; ++i) {
+    el->value.p[i] += el->value.v[i];
+  }
+}
+
+// Registers table as a collection with one pipeline over it. Both schemas
+// share the same Element layout.
+template<typename Schema_>
+radiance::Collection* add_transformations(const char* name,
+                                          typename Schema_::Table* table,
+                                          radiance::SpanOf span) {
+  typedef typename Schema_::Table Table;
+  typedef typename Schema_::Element Element;
+  radiance::Collection* c = radiance::add_collection(kMainProgram, name);
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Element* el = (Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Transformation(*(Transformation*)(value));
+      };
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Table* t = (Table*)c->collection;
+        Element* el = (Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Table*)c->collection)->size();
+  };
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Transformation);
+  c->values.offset = 0;
+  c->span = span;
+
+  radiance::Pipeline* pipeline = radiance::add_pipeline(kMainProgram, name, name);
+  pipeline->select = nullptr;
+  pipeline->transform = integrate;
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  return c;
+}
+
+// Returns the average insert time and writes the slowest one to worst.
+template<typename Table_>
+double time_inserts(Table_* table, uint64_t count, double* worst) {
+  Timer timer;
+  double total = 0.0;
+  *worst = 0.0;
+  for (uint64_t i = 0; i < count; ++i) {
+    timer.start();
+    table->insert(i, Transformation{{(float)i, 0, 0}, {1, 0, 0}});
+    timer.stop();
+    double ns = timer.get_elapsed_ns();
+    total += ns;
+    *worst = std::max(*worst, ns);
+  }
+  return total / count;
+}
+
+double time_loop(uint64_t iterations) {
+  Timer timer;
+  double total = 0.0;
+  for (uint64_t i = 0; i < iterations; ++i) {
+    timer.start();
+    radiance::loop();
+    timer.stop();
+    total += timer.get_elapsed_ns();
+  }
+  return total / iterations;
+}
+
+int main() {
+  uint64_t count = 1 << 22;
+  uint64_t iterations = 20;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  Contiguous::Table* contiguous = new Contiguous::Table();
+  Paged::Table* paged = new Paged::Table();
+
+  double worst;
+  double avg = time_inserts(contiguous, count, &worst);
+  std::cout << "vector insert avg ns: " << avg << ", worst ms: "
+            << worst / 1e6 << std::endl;
+  avg = time_inserts(paged, count, &worst);
+  std::cout << "paged insert avg ns: " << avg << ", worst ms: "
+            << worst / 1e6 << std::endl;
+
+  {
+    radiance::Universe uni;
+    radiance::init(&uni);
+    radiance::create_program(kMainProgram);
+    radiance::Collection* c =
+        add_transformations<Contiguous>("contiguous", contiguous, nullptr);
+    c->keys.data = (uint8_t*)contiguous->keys.data();
+    c->values.data = (uint8_t*)contiguous->values.data();
+    radiance::start();
+    std::cout << "vector loop avg ns per entity: "
+              << time_loop(iterations) / count << std::endl;
+    radiance::stop();
+  }
+
+  {
+    radiance::Universe uni;
+    radiance::init(&uni);
+    radiance::create_program(kMainProgram);
+    add_transformations<Paged>("paged", paged,
+                              radiance::paged_span<Paged::Table>);
+    radiance::start();
+    std::cout << "paged loop avg ns per entity: "
+              << time_loop(iterations) / count << std::endl;
+    radiance::stop();
+  }
+
+  bool same = true;
+  for (uint64_t i = 0; i < count; ++i) {
+    same &= contiguous->values[i].p[0] == paged->values[i].p[0];
+  }
+  std::cout << "results match: " << same << std::endl;
+  return 0;
+}
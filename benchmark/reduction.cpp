@@ -0,0 +1,309 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+struct Body {
+  float p[3];
+  float v[3];
+  float mass;
+};
+
+// The bounding box, kinetic energy, and number of the bodies.
+struct Summary {
+  float lo[3];
+  float hi[3];
+  double energy;
+  uint64_t count;
+};
+
+typedef radiance::Schema<uint32_t, Body> Bodies;
+typedef radiance::Schema<uint32_t, Summary> Summaries;
+
+const char kMainProgram[] = "main";
+
+const Summary kEmpty = {
+    {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+     std::numeric_limits<float>::max()},
+    {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+     std::numeric_limits<float>::lowest()},
+    0, 0};
+
+void add_bodies(Bodies::Table* table) {
+  radiance::Collection* c = radiance::add_collection(kMainProgram, "bodies");
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Bodies::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Bodies::Element* el = (Bodies::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Body(*(Body*)(value));
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Bodies::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Bodies::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Body);
+  c->values.offset = 0;
+}
+
+void add_summaries(Summaries::Table* table) {
+  radiance::Collection* c = radiance::add_collection(kMainProgram, "summary");
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Summaries::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Summaries::Element* el = (Summaries::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Summary(*(Summary*)(value));
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Summaries::Table*)c->collection)->size();
+  };
+  c->load = radiance::load_table<Summaries::Table>;
+  c->bind = radiance::bind_table<Summaries::Table>;
+  c->keys.size = sizeof(uint32_t);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Summary);
+  c->values.offset = 0;
+}
+
+inline const Body& body_on(radiance::Stack* s) {
+  return ((Bodies::Element*)((radiance::Mutation*)(s->top()))->element)->value;
+}
+
+void accumulate(radiance::Stack* s, uint8_t* partial) {
+  const Body& b = body_on(s);
+  Summary* sum = (Summary*)partial;
+  for (int i = 0; i < 3; ++i) {
+    sum->lo[i] = std::min(sum->lo[i], b.p[i]);
+    sum->hi[i] = std::max(sum->hi[i], b.p[i]);
+  }
+  sum->energy += 0.5 * b.mass *
+      (b.v[0] * b.v[0] + b.v[1] * b.v[1] + b.v[2] * b.v[2]);
+  ++sum->count;
+}
+
+void combine(uint8_t* partial, const uint8_t* other) {
+  Summary* sum = (Summary*)partial;
+  const Summary* o = (const Summary*)other;
+  for (int i = 0; i < 3; ++i) {
+    sum->lo[i] = std::min(sum->lo[i], o->lo[i]);
+    sum->hi[i] = std::max(sum->hi[i], o->hi[i]);
+  }
+  sum->energy += o->energy;
+  sum->count += o->count;
+}
+
+// The same summary with a global atomic per field, as a 1 to 0 pipeline
+// would have to.
+struct AtomicSummary {
+  std::atomic<float> lo[3];
+  std::atomic<float> hi[3];
+  std::atomic<double> energy;
+  std::atomic<uint64_t> count;
+};
+AtomicSummary atomic_summary;
+
+template<typename T, typename Better_>
+void atomic_improve(std::atomic<T>* a, T value, Better_ better) {
+  T current = a->load(std::memory_order_relaxed);
+  while (better(value, current) &&
+         !a->compare_exchange_weak(current, value,
+                                   std::memory_order_relaxed)) {}
+}
+
+void accumulate_atomic(radiance::Stack* s) {
+  const Body& b = body_on(s);
+  for (int i = 0; i < 3; ++i) {
+    atomic_improve(&atomic_summary.lo[i], b.p[i],
+                   [](float x, float y) { return x < y; });
+    atomic_improve(&atomic_summary.hi[i], b.p[i],
+                   [](float x, float y) { return x > y; });
+  }
+  double e = 0.5 * b.mass *
+      (b.v[0] * b.v[0] + b.v[1] * b.v[1] + b.v[2] * b.v[2]);
+  double current = atomic_summary.energy.load(std::memory_order_relaxed);
+  while (!atomic_summary.energy.compare_exchange_weak(
+      current, current + e, std::memory_order_relaxed)) {}
+  atomic_summary.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void reset_atomic() {
+  for (int i = 0; i < 3; ++i) {
+    atomic_summary.lo[i] = kEmpty.lo[i];
+    atomic_summary.hi[i] = kEmpty.hi[i];
+  }
+  atomic_summary.energy = 0;
+  atomic_summary.count = 0;
+}
+
+// Read by a pipeline over the summary, to show that the result can be used
+// like any other collection.
+uint64_t summary_reads = 0;
+uint64_t summarized = 0;
+
+double run_frames(uint64_t frames) {
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < frames; ++i) {
+    radiance::loop();
+  }
+  timer.stop();
+  return timer.get_elapsed_ns() / 1e6 / frames;
+}
+
+Summary summarize(const Bodies::Table& bodies) {
+  Summary sum = kEmpty;
+  for (const Body& b : bodies.values) {
+    for (int i = 0; i < 3; ++i) {
+      sum.lo[i] = std::min(sum.lo[i], b.p[i]);
+      sum.hi[i] = std::max(sum.hi[i], b.p[i]);
+    }
+    sum.energy += 0.5 * b.mass *
+        (b.v[0] * b.v[0] + b.v[1] * b.v[1] + b.v[2] * b.v[2]);
+    ++sum.count;
+  }
+  return sum;
+}
+
+bool matches(const Summary& a, const Summary& b) {
+  bool ret = a.count == b.count &&
+      std::abs(a.energy - b.energy) <= 1e-9 * std::abs(b.energy);
+  for (int i = 0; i < 3; ++i) {
+    ret &= a.lo[i] == b.lo[i] && a.hi[i] == b.hi[i];
+  }
+  return ret;
+}
+
+int main() {
+  uint64_t count = 1 << 20;
+  uint64_t frames = 50;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Body count: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+
+  Bodies::Table bodies;
+  for (uint64_t i = 0; i < count; ++i) {
+    float x = (float)((i * 2654435761u) % 10007);
+    bodies.insert((uint32_t)i, Body{{x, -x, x / 2}, {1, 2, (float)(i % 7)},
+                                    1.0f + i % 3});
+  }
+  Summaries::Table summaries;
+  add_bodies(&bodies);
+  add_summaries(&summaries);
+
+  Summary expected = summarize(bodies);
+
+  radiance::Pipeline* reduce =
+      radiance::add_pipeline(kMainProgram, "bodies", "summary");
+  reduce->reduce.size = sizeof(Summary);
+  reduce->reduce.identity = (const uint8_t*)&kEmpty;
+  reduce->reduce.accumulate = accumulate;
+  reduce->reduce.combine = combine;
+
+  radiance::Pipeline* reader =
+      radiance::add_pipeline(kMainProgram, "summary", nullptr);
+  reader->transform = [](radiance::Stack* s) {
+    Summaries::Element* el = (Summaries::Element*)
+        ((radiance::Mutation*)(s->top()))->element;
+    ++summary_reads;
+    summarized = el->value.count;
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(reduce, policy);
+  policy.priority = 0;
+  enable_pipeline(reader, policy);
+  radiance::start();
+
+  double reduce_ms = run_frames(frames);
+  std::cout << "reduction frame ms: " << reduce_ms << std::endl;
+  std::cout << "reduction matches: "
+            << (summaries.size() == 1 && matches(summaries.values[0], expected))
+            << ", read by pipeline: " << (summary_reads == frames)
+            << ", count: " << summarized << std::endl;
+
+  // The same with global atomics.
+  radiance::disable_pipeline(reduce);
+  radiance::disable_pipeline(reader);
+  radiance::Pipeline* atomic =
+      radiance::add_pipeline(kMainProgram, "bodies", nullptr);
+  atomic->transform = accumulate_atomic;
+  policy.priority = radiance::MAX_PRIORITY;
+  enable_pipeline(atomic, policy);
+
+  Timer timer;
+  uint64_t atomic_ns = 0;
+  for (uint64_t i = 0; i < frames; ++i) {
+    reset_atomic();
+    timer.start();
+    radiance::loop();
+    timer.stop();
+    atomic_ns += timer.get_elapsed_ns();
+  }
+  Summary result;
+  for (int i = 0; i < 3; ++i) {
+    result.lo[i] = atomic_summary.lo[i];
+    result.hi[i] = atomic_summary.hi[i];
+  }
+  result.energy = atomic_summary.energy;
+  result.count = atomic_summary.count;
+  std::cout << "atomic frame ms: " << atomic_ns / 1e6 / frames << std::endl;
+  std::cout << "atomic matches: " << matches(result, expected) << std::endl;
+
+  // A reduction cut short by the frame budget, after which the bodies shrink
+  // past where it stopped, starts over instead of adding to what it had.
+  radiance::disable_pipeline(atomic);
+  policy.priority = 0;
+  enable_pipeline(reduce, policy);
+  uint64_t deferred = radiance::frame_stats().deferred;
+  for (uint64_t budget = 1000000; budget > 1000 &&
+       radiance::frame_stats().deferred == deferred; budget /= 2) {
+    radiance::set_frame_budget(budget, radiance::MAX_PRIORITY);
+    radiance::loop();
+  }
+  bool was_deferred = radiance::frame_stats().deferred > deferred;
+
+  // Every run gets through at least a round of pieces first, which is more
+  // than this.
+  uint64_t kept = 1024;
+  std::vector<uint32_t> keys(bodies.keys.begin(), bodies.keys.begin() + kept);
+  std::vector<Body> values(bodies.values.begin(),
+                           bodies.values.begin() + kept);
+  bodies.assign(keys.data(), values.data(), kept);
+  radiance::set_frame_budget(0, radiance::MAX_PRIORITY);
+  radiance::loop();
+  std::cout << "deferred then shrunk: " << was_deferred << ", matches: "
+            << (summaries.size() == 1 &&
+                matches(summaries.values[0], summarize(bodies)))
+            << std::endl;
+  radiance::stop();
+  return 0;
+}
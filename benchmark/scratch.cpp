@@ -0,0 +1,180 @@
+#include "inc/radiance.h"
+#include "inc/frame.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+// Larger than the whole stack used to be.
+struct Cloud {
+  float p[3];
+  float v[3];
+  float samples[256];
+};
+
+typedef radiance::Schema<uint32_t, Cloud> Clouds;
+
+typedef float float8 __attribute__((vector_size(32), aligned(32)));
+
+const char kMainProgram[] = "main";
+
+// Fills 16 temporaries and reduces them.
+float smooth(float8* t, float x) {
+  for (int i = 0; i < 16; ++i) {
+    t[i] = float8{x, x, x, x, x, x, x, x} * (float)i;
+  }
+  float8 sum = {};
+  for (int i = 0; i < 15; ++i) {
+    sum += 0.5f * (t[i] + t[i + 1]);
+  }
+  return sum[0] + sum[7];
+}
+
+void add_clouds(uint64_t count) {
+  radiance::Collection* c = radiance::add_collection(kMainProgram, "clouds");
+
+  Clouds::Table* table = new Clouds::Table();
+  for (uint64_t i = 0; i < count; ++i) {
+    Cloud cloud = {};
+    cloud.v[0] = 1;
+    for (uint64_t j = 0; j < 256; ++j) {
+      cloud.samples[j] = (float)j;
+    }
+    table->insert(i, cloud);
+  }
+
+  c->collection = (uint8_t*)table;
+  c->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Clouds::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Clouds::Element* el = (Clouds::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Cloud(*(Cloud*)(value));
+      };
+  c->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Clouds::Table* t = (Clouds::Table*)c->collection;
+        Clouds::Element* el = (Clouds::Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Clouds::Table*)c->collection)->size();
+  };
+  c->bind = radiance::bind_table<Clouds::Table>;
+  c->keys.size = sizeof(Clouds::Key);
+  c->keys.offset = 0;
+  c->values.size = sizeof(Clouds::Value);
+  c->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "clouds", "clouds");
+  pipeline->select = nullptr;
+
+  // Smooths the samples through a temporary buffer on the stack, which is
+  // popped before the mutation is applied.
+  pipeline->transform = [](radiance::Stack* s) {
+    Clouds::Element* el =
+        (Clouds::Element*)((radiance::Mutation*)(s->top()))->element;
+    float* smoothed = (float*)s->alloc(sizeof(el->value.samples));
+    for (int i = 0; i < 256; ++i) {
+      smoothed[i] = 0.5f * (el->value.samples[i] +
+                            el->value.samples[(i + 1) % 256]);
+    }
+    memcpy(el->value.samples, smoothed, sizeof(el->value.samples));
+    s->free();
+    for (int i = 0; i < 3; ++i) {
+      el->value.p[i] += el->value.v[i];
+    }
+  };
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+}
+
+int main() {
+  uint64_t count = 1 << 16;
+  uint64_t iterations = 50;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Number of iterations: " << iterations << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+  std::cout << "Value size: " << sizeof(Cloud) << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+  add_clouds(count);
+  radiance::start();
+
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < iterations; ++i) {
+    radiance::loop();
+  }
+  timer.stop();
+  std::cout << "pipeline avg ns per entity: "
+            << timer.get_elapsed_ns() / iterations / count << std::endl;
+
+  radiance::ScratchStats stats = radiance::scratch_stats();
+  std::cout << "scratch threads: " << stats.threads
+            << ", capacity: " << stats.capacity
+            << ", high water: " << stats.high_water
+            << ", chunk allocations: " << stats.chunk_allocations << std::endl;
+  radiance::stop();
+
+  // A Frame grows past its first chunk once and then stays in one chunk.
+  radiance::Frame frame;
+  uint64_t pushes = 1 << 12;
+  timer.start();
+  for (uint64_t i = 0; i < iterations; ++i) {
+    for (uint64_t j = 0; j < pushes; ++j) {
+      frame.push(Cloud{});
+    }
+    frame.reset();
+  }
+  timer.stop();
+  const radiance::Arena::Stats& frame_stats = frame.stats();
+  std::cout << "frame push avg ns: "
+            << timer.get_elapsed_ns() / iterations / pushes << std::endl;
+  std::cout << "frame capacity: " << frame_stats.capacity
+            << ", frame high water: " << frame_stats.frame_high_water
+            << ", chunk allocations: " << frame_stats.chunk_allocations
+            << std::endl;
+
+  // SIMD temporaries, as a transform would build them, on the stack and on
+  // the heap. Loads and stores of float8 assume 32 byte alignment.
+  radiance::Stack stack;
+  uint64_t temporaries = 1 << 18;
+  float sum = 0;
+  bool aligned = true;
+  timer.start();
+  for (uint64_t i = 0; i < temporaries; ++i) {
+    float8* t = stack.alloc_array<float8>(16);
+    aligned &= ((uintptr_t)t & 31) == 0;
+    sum += smooth(t, (float)i);
+    stack.free();
+  }
+  timer.stop();
+  std::cout << "stack temporaries avg ns: "
+            << timer.get_elapsed_ns() / temporaries
+            << ", aligned: " << aligned << std::endl;
+
+  timer.start();
+  for (uint64_t i = 0; i < temporaries; ++i) {
+    float8* t = (float8*)aligned_alloc(32, 16 * sizeof(float8));
+    sum += smooth(t, (float)i);
+    free(t);
+  }
+  timer.stop();
+  std::cout << "heap temporaries avg ns: "
+            << timer.get_elapsed_ns() / temporaries << std::endl;
+  std::cout << "checksum: " << sum << std::endl;
+  return 0;
+}
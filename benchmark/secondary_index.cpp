@@ -0,0 +1,170 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/secondary_index.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+struct Unit {
+  uint32_t team;
+  float health;
+};
+
+typedef radiance::Schema<uint32_t, Unit> Units;
+typedef radiance::HashIndex<Units::Table, uint32_t> TeamIndex;
+typedef radiance::SortedIndex<Units::Table, float> HealthIndex;
+
+const char kMainProgram[] = "main";
+const uint32_t kTeamCount = 16;
+const uint32_t kHealedTeam = 3;
+
+TeamIndex* team_index = nullptr;
+std::vector<uint64_t> healed_rows;
+
+uint32_t team_of(const Unit& unit) {
+  return unit.team;
+}
+
+float health_of(const Unit& unit) {
+  return unit.health;
+}
+
+void heal_team(radiance::Stack* s) {
+  Units::Element* el =
+      (Units::Element*)((radiance::Mutation*)(s->top()))->element;
+  if (el->value.team == kHealedTeam) {
+    el->value.health += 1.0f;
+  }
+}
+
+void select_healed_team(radiance::Pipeline*, radiance::Collection*,
+                        radiance::Selection* selection) {
+  healed_rows.clear();
+  team_index->select(kHealedTeam, &healed_rows);
+  selection->count = healed_rows.size();
+  selection->rows = healed_rows.data();
+}
+
+radiance::Pipeline* add_units(Units::Table* table) {
+  radiance::Collection* units = radiance::add_collection(kMainProgram, "units");
+
+  units->collection = (uint8_t*)table;
+  units->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Units::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Units::Element* el = (Units::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Units::Value(*(Units::Value*)(value));
+      };
+  units->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Units::Table* t = (Units::Table*)c->collection;
+        Units::Element* el = (Units::Element*)(m->element);
+        t->update_at(el->offset, std::move(el->value));
+      };
+  units->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Units::Table*)c->collection)->size();
+  };
+
+  units->keys.data = (uint8_t*)table->keys.data();
+  units->keys.size = sizeof(Units::Key);
+  units->keys.offset = 0;
+  units->values.data = (uint8_t*)table->values.data();
+  units->values.size = sizeof(Units::Value);
+  units->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "units", "units");
+  pipeline->select = nullptr;
+  pipeline->transform = heal_team;
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  return pipeline;
+}
+
+double time_loop(uint64_t iterations) {
+  Timer timer;
+  double total = 0.0;
+  for (uint64_t i = 0; i < iterations; ++i) {
+    timer.start();
+    radiance::loop();
+    timer.stop();
+    total += timer.get_elapsed_ns();
+  }
+  return total / iterations;
+}
+
+// Moves every unit to the next team.
+double time_flush(Units::Table* table, uint64_t count, uint32_t shift) {
+  radiance::MutationBuffer<Units::Table> buffer;
+  for (uint64_t i = 0; i < count; ++i) {
+    buffer.emplace<radiance::MutateBy::UPDATE, radiance::IndexedBy::OFFSET>(
+        (radiance::Offset)i, Unit{(uint32_t)((i + shift) % kTeamCount), (float)(i % 100)});
+  }
+  Timer timer;
+  timer.start();
+  buffer.flush(table);
+  timer.stop();
+  return timer.get_elapsed_ns();
+}
+
+int main() {
+  uint64_t count = 1 << 20;
+  uint64_t iterations = 100;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Number of iterations: " << iterations << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  Units::Table* table = new Units::Table();
+  table->keys.reserve(count);
+  table->values.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    table->insert(i, Unit{(uint32_t)(i % kTeamCount), (float)(i % 100)});
+  }
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+  radiance::Pipeline* pipeline = add_units(table);
+  radiance::start();
+
+  double flush_without = time_flush(table, count, 1);
+
+  team_index = new TeamIndex(table, team_of);
+  HealthIndex health_index(table, health_of);
+  double flush_with = time_flush(table, count, 2);
+
+  std::cout << "flush ns per update without indexes: "
+            << flush_without / count << std::endl;
+  std::cout << "flush ns per update with hash and sorted index: "
+            << flush_with / count << std::endl;
+
+  double scan = time_loop(iterations);
+  pipeline->select_rows = select_healed_team;
+  double selected = time_loop(iterations);
+
+  std::cout << "selected rows: " << team_index->count(kHealedTeam) << std::endl;
+  std::cout << "full scan avg ms per loop: " << scan / 1e6 << std::endl;
+  std::cout << "indexed select avg ms per loop: " << selected / 1e6 << std::endl;
+
+  std::vector<uint64_t> rows;
+  Timer timer;
+  timer.start();
+  health_index.select(10.0f, 19.0f, &rows);
+  timer.stop();
+  std::cout << "health range [10, 19]: " << rows.size() << " rows in "
+            << timer.get_elapsed_ns() / 1e6 << " ms" << std::endl;
+
+  radiance::stop();
+  delete team_index;
+  return 0;
+}
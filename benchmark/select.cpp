@@ -0,0 +1,140 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+struct Body {
+  float p[3];
+  float v[3];
+  uint32_t active;
+};
+
+typedef radiance::Schema<uint32_t, Body> Bodies;
+
+const char kMainProgram[] = "main";
+
+radiance::Pipeline* add_bodies(uint64_t count, uint64_t active_every) {
+  radiance::Collection* bodies = radiance::add_collection(kMainProgram, "bodies");
+
+  Bodies::Table* table = new Bodies::Table();
+  table->keys.reserve(count);
+  table->values.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    Body body{{(float)i, 0, 0}, {1, 0, 0}, i % active_every == 0};
+    table->insert(i, body);
+  }
+
+  bodies->collection = (uint8_t*)table;
+  bodies->copy =
+      [](const uint8_t*, const uint8_t* value, uint64_t offset,
+         radiance::Stack* stack) {
+        radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
+            sizeof(radiance::Mutation) + sizeof(Bodies::Element));
+        mutation->element = (uint8_t*)(mutation + 1);
+        mutation->mutate_by = radiance::MutateBy::UPDATE;
+        Bodies::Element* el = (Bodies::Element*)(mutation->element);
+        el->offset = offset;
+        new (&el->value) Bodies::Value(*(Bodies::Value*)(value));
+      };
+  bodies->mutate =
+      [](radiance::Collection* c, const radiance::Mutation* m) {
+        Bodies::Table* t = (Bodies::Table*)c->collection;
+        Bodies::Element* el = (Bodies::Element*)(m->element);
+        t->values[el->offset] = std::move(el->value);
+      };
+  bodies->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Bodies::Table*)c->collection)->size();
+  };
+
+  bodies->keys.data = (uint8_t*)table->keys.data();
+  bodies->keys.size = sizeof(Bodies::Key);
+  bodies->keys.offset = 0;
+  bodies->values.data = (uint8_t*)table->values.data();
+  bodies->values.size = sizeof(Bodies::Value);
+  bodies->values.offset = 0;
+
+  radiance::Pipeline* pipeline =
+      radiance::add_pipeline(kMainProgram, "bodies", "bodies");
+
+  radiance::ExecutionPolicy policy;
+  policy.priority = radiance::MAX_PRIORITY;
+  policy.trigger = radiance::Trigger::LOOP;
+  enable_pipeline(pipeline, policy);
+  return pipeline;
+}
+
+void integrate(Body* body) {
+  for (int i = 0; i < 3; ++i) {
+    body->p[i] += body->v[i];
+  }
+}
+
+// Checks every element in the transform.
+void integrate_active(radiance::Stack* s) {
+  Bodies::Element* el =
+      (Bodies::Element*)((radiance::Mutation*)(s->top()))->element;
+  if (el->value.active) {
+    integrate(&el->value);
+  }
+}
+
+// Only sees the elements that passed select_active.
+void integrate_selected(radiance::Stack* s) {
+  Bodies::Element* el =
+      (Bodies::Element*)((radiance::Mutation*)(s->top()))->element;
+  integrate(&el->value);
+}
+
+void select_active(const uint8_t* values, uint64_t count, uint8_t* selected) {
+  const Body* bodies = (const Body*)values;
+  for (uint64_t i = 0; i < count; ++i) {
+    selected[i] = bodies[i].active != 0;
+  }
+}
+
+double time_loop(uint64_t iterations) {
+  Timer timer;
+  double total = 0.0;
+  for (uint64_t i = 0; i < iterations; ++i) {
+    timer.start();
+    radiance::loop();
+    timer.stop();
+    total += timer.get_elapsed_ns();
+  }
+  return total / iterations;
+}
+
+int main() {
+  uint64_t count = 1 << 20;
+  uint64_t iterations = 50;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Number of iterations: " << iterations << std::endl;
+  std::cout << "Entity count: " << count << std::endl;
+
+  uint64_t active_every[] = {1, 2, 10, 100};
+  for (uint64_t every : active_every) {
+    radiance::Universe uni;
+    radiance::init(&uni);
+    radiance::create_program(kMainProgram);
+    radiance::Pipeline* pipeline = add_bodies(count, every);
+    radiance::start();
+
+    pipeline->select = nullptr;
+    pipeline->transform = integrate_active;
+    double branch = time_loop(iterations);
+
+    pipeline->select = select_active;
+    pipeline->transform = integrate_selected;
+    double selected = time_loop(iterations);
+
+    std::cout << "1 in " << every << " active" << std::endl;
+    std::cout << "  branch in transform avg ms per loop: " << branch / 1e6 << std::endl;
+    std::cout << "  select avg ms per loop: " << selected / 1e6 << std::endl;
+    radiance::stop();
+  }
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include "inc/radiance.h"
+#include "inc/table.h"
+#include "inc/stack_memory.h"
+#include "inc/schema.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <utility>
+
+struct Particle {
+  float p[3];
+  float v[3];
+  float life;
+};
+
+struct Emitter {
+  float p[3];
+  uint32_t rate;
+};
+
+typedef radiance::Schema<uint32_t, Particle> Particles;
+typedef radiance::Schema<uint32_t, Emitter> Emitters;
+
+const char kMainProgram[] = "main";
+const char kSnapshotPath[] = "snapshot.bench";
+
+template<typename Table_>
+void add_table(const char* name, Table_* table) {
+  radiance::Collection* c = radiance::add_collection(kMainProgram, name);
+
+  c->collection = (uint8_t*)table;
+  c->count = [](radiance::Collection* c) -> uint64_t {
+    return ((Table_*)c->collection)->size();
+  };
+  c->load = radiance::load_table<Table_>;
+  c->bind = radiance::bind_table<Table_>;
+  c->keys.size = sizeof(typename Table_::Key);
+  c->keys.offset = 0;
+  c->values.size = sizeof(typename Table_::Value);
+  c->values.offset = 0;
+}
+
+template<typename Table_>
+bool equal(const Table_& a, const Table_& b) {
+  typedef typename Table_::Value Value;
+  return a.size() == b.size() &&
+      memcmp(a.keys.data(), b.keys.data(),
+             a.size() * sizeof(typename Table_::Key)) == 0 &&
+      memcmp(a.values.data(), b.values.data(), a.size() * sizeof(Value)) == 0;
+}
+
+int main() {
+  uint64_t count = 1 << 20;
+  uint64_t emitter_count = 1 << 10;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Particle count: " << count << std::endl;
+
+  radiance::Universe uni;
+  radiance::init(&uni);
+  radiance::create_program(kMainProgram);
+
+  Particles::Table particles;
+  for (uint64_t i = 0; i < count; ++i) {
+    float life = (float)((i * 2654435761u) % 100);
+    particles.insert((uint32_t)i, Particle{{(float)i, 0, 0}, {1, 0, 0}, life});
+  }
+  Emitters::Table emitters;
+  for (uint64_t i = 0; i < emitter_count; ++i) {
+    emitters.insert((uint32_t)i, Emitter{{(float)i, 0, 0}, (uint32_t)i % 16});
+  }
+  add_table("particles", &particles);
+  add_table("emitters", &emitters);
+  radiance::start();
+
+  const Particles::Table expected_particles = particles;
+  const Emitters::Table expected_emitters = emitters;
+
+  const std::pair<const char*, radiance::Compression> modes[] = {
+    {"none", radiance::Compression::NONE},
+    {"lz", radiance::Compression::LZ},
+  };
+  Timer timer;
+  for (const auto& mode : modes) {
+    timer.start();
+    radiance::Status::Code saved =
+        radiance::save_snapshot(kSnapshotPath, mode.second);
+    timer.stop();
+    double save_ms = timer.get_elapsed_ns() / 1e6;
+
+    struct stat st;
+    stat(kSnapshotPath, &st);
+
+    particles.assign(nullptr, nullptr, 0);
+    emitters.assign(nullptr, nullptr, 0);
+    timer.start();
+    radiance::Status::Code loaded = radiance::load_snapshot(kSnapshotPath);
+    timer.stop();
+    double load_ms = timer.get_elapsed_ns() / 1e6;
+
+    std::cout << mode.first << ": save ms " << save_ms << ", load ms "
+              << load_ms << ", MB " << st.st_size / 1e6 << ", matches: "
+              << (saved == radiance::Status::OK &&
+                  loaded == radiance::Status::OK &&
+                  equal(particles, expected_particles) &&
+                  equal(emitters, expected_emitters))
+              << std::endl;
+  }
+
+  // A snapshot cut short in its last column loads nothing, not even the
+  // collections before it.
+  struct stat st;
+  stat(kSnapshotPath, &st);
+  bool truncated = truncate(kSnapshotPath, st.st_size - 4096) == 0;
+  particles.assign(nullptr, nullptr, 0);
+  emitters.assign(nullptr, nullptr, 0);
+  radiance::Status::Code loaded = radiance::load_snapshot(kSnapshotPath);
+  std::cout << "truncated snapshot rejected: "
+            << (truncated && loaded != radiance::Status::OK)
+            << ", left as was: "
+            << (particles.size() == 0 && emitters.size() == 0) << std::endl;
+
+  unlink(kSnapshotPath);
+  radiance::stop();
+  return 0;
+}
@@ -0,0 +1,78 @@
+#include "inc/radiance.h"
+#include "inc/schema.h"
+#include "inc/spatial_index.h"
+#include "inc/timer.h"
+
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <omp.h>
+
+struct Particle {
+  glm::vec3 p;
+  glm::vec3 v;
+};
+
+typedef radiance::Schema<uint32_t, Particle> Particles;
+typedef radiance::SpatialIndex<Particles::Table> ParticleIndex;
+
+ParticleIndex::Point position(const Particle& particle) {
+  return {particle.p.x, particle.p.y, particle.p.z};
+}
+
+void run(uint64_t count) {
+  // Keep the density at about 8 particles per cell as the count grows.
+  const float cell_size = 1.0f;
+  float side = std::cbrt((float)count / 8.0f);
+
+  Particles::Table table;
+  table.keys.reserve(count);
+  table.values.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    glm::vec3 p{
+      side * ((float)(rand() % 10000) / 10000.0f),
+      side * ((float)(rand() % 10000) / 10000.0f),
+      side * ((float)(rand() % 10000) / 10000.0f)
+    };
+    table.insert(i, {p, glm::vec3{0, 0, 0}});
+  }
+
+  ParticleIndex index(&table, position, cell_size);
+
+  const int rebuilds = 10;
+  Timer timer;
+  double rebuild_ns = 0.0;
+  for (int i = 0; i < rebuilds; ++i) {
+    timer.start();
+    index.rebuild();
+    timer.stop();
+    rebuild_ns += timer.get_elapsed_ns();
+  }
+  rebuild_ns /= rebuilds;
+
+  uint64_t neighbors = 0;
+  timer.start();
+#pragma omp parallel for reduction(+:neighbors)
+  for (uint64_t i = 0; i < count; ++i) {
+    index.query(position(table.values[i]), cell_size,
+                [&neighbors](uint64_t, const ParticleIndex::Point&) {
+                  ++neighbors;
+                });
+  }
+  timer.stop();
+  double query_ns = timer.get_elapsed_ns();
+
+  std::cout << "Entity count: " << count << std::endl;
+  std::cout << "  rebuild ms: " << rebuild_ns / 1e6 << std::endl;
+  std::cout << "  rebuild ns per entity: " << rebuild_ns / count << std::endl;
+  std::cout << "  query throughput: " << count / (query_ns / 1e9) << std::endl;
+  std::cout << "  avg neighbors per query: " << (double)neighbors / count << std::endl;
+}
+
+int main() {
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  for (uint64_t count = 100000; count <= 10000000; count *= 10) {
+    run(count);
+  }
+  return 0;
+}
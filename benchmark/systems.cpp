@@ -0,0 +1,213 @@
+#include "inc/system.h"
+#include "inc/timer.h"
+
+#include <omp.h>
+
+#include <cmath>
+#include <functional>
+#include <vector>
+
+// Some work for a system to do on its own data.
+void simulate(std::vector<float>* data) {
+  for (float& x : *data) {
+    x = std::sqrt(x * x + 1.0f);
+  }
+}
+
+double time_frames(radiance::SystemExecutor* executor, uint64_t frames) {
+  radiance::Frame frame;
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < frames; ++i) {
+    (*executor)(&frame);
+  }
+  timer.stop();
+  return timer.get_elapsed_ns() / frames;
+}
+
+int main() {
+  uint64_t system_count = 64;
+  uint64_t size = 1 << 16;
+  uint64_t frames = 50;
+  std::cout << "Number of threads: " << omp_get_max_threads() << std::endl;
+  std::cout << "Number of systems: " << system_count << std::endl;
+
+  std::vector<std::vector<float>> data(system_count, std::vector<float>(size, 1.0f));
+
+  // Each system writes its own data and reads the shared config.
+  const radiance::Id kConfig = system_count;
+  radiance::SystemExecutor independent;
+  for (uint64_t i = 0; i < system_count; ++i) {
+    radiance::Access access;
+    access.reads.push_back(kConfig);
+    access.writes.push_back(i);
+    std::vector<float>* d = &data[i];
+    independent.push([d](radiance::Frame*) { simulate(d); }, access);
+  }
+
+  // Every system writes the shared config, so they run one after another.
+  radiance::SystemExecutor chained;
+  for (uint64_t i = 0; i < system_count; ++i) {
+    radiance::Access access;
+    access.writes.push_back(kConfig);
+    std::vector<float>* d = &data[i];
+    chained.push([d](radiance::Frame*) { simulate(d); }, access);
+  }
+
+  std::cout << "independent stages: " << independent.stages()
+            << ", avg ms per frame: " << time_frames(&independent, frames) / 1e6
+            << std::endl;
+  std::cout << "chained stages: " << chained.stages()
+            << ", avg ms per frame: " << time_frames(&chained, frames) / 1e6
+            << std::endl;
+
+  // Systems scratch per thread Frames.
+  radiance::SystemExecutor scratch;
+  for (uint64_t i = 0; i < system_count; ++i) {
+    radiance::Access access;
+    access.writes.push_back(i);
+    std::vector<float>* d = &data[i];
+    scratch.push([d](radiance::Frame* frame) {
+      float* tmp = frame->push_array<float>(d->size());
+      for (uint64_t j = 0; j < d->size(); ++j) {
+        tmp[j] = (*d)[j];
+      }
+      (*d)[0] = tmp[d->size() - 1];
+      frame->pop();
+    }, access);
+  }
+  std::cout << "scratch avg ms per frame: "
+            << time_frames(&scratch, frames) / 1e6 << std::endl;
+
+  // Dispatch cost of many small systems whose state fits into
+  // std::function's own small buffer.
+  uint64_t calls = 1 << 22;
+  float counters[4] = {0, 0, 0, 0};
+  float* c = counters;
+  std::vector<std::function<void(radiance::Frame*)>> functions;
+  std::vector<radiance::System> systems;
+  for (int i = 0; i < 4; ++i) {
+    functions.push_back([c, i](radiance::Frame*) { c[i] += 1.0f; });
+    systems.push_back([c, i](radiance::Frame*) { c[i] += 1.0f; });
+  }
+  auto fixed = radiance::make_static_executor(
+      [c](radiance::Frame*) { c[0] += 1.0f; },
+      [c](radiance::Frame*) { c[1] += 1.0f; },
+      [c](radiance::Frame*) { c[2] += 1.0f; },
+      [c](radiance::Frame*) { c[3] += 1.0f; });
+
+  radiance::Frame frame;
+  Timer timer;
+  timer.start();
+  for (uint64_t i = 0; i < calls / 4; ++i) {
+    for (auto& f : functions) {
+      f(&frame);
+    }
+  }
+  timer.stop();
+  std::cout << "std::function avg ns per call: "
+            << timer.get_elapsed_ns() / calls << std::endl;
+
+  timer.start();
+  for (uint64_t i = 0; i < calls / 4; ++i) {
+    for (auto& s : systems) {
+      s(&frame);
+    }
+  }
+  timer.stop();
+  std::cout << "System avg ns per call: "
+            << timer.get_elapsed_ns() / calls << std::endl;
+
+  timer.start();
+  for (uint64_t i = 0; i < calls / 4; ++i) {
+    fixed(&frame);
+  }
+  timer.stop();
+  std::cout << "StaticSystemExecutor avg ns per call: "
+            << timer.get_elapsed_ns() / calls << std::endl;
+  std::cout << "checksum: " << counters[0] + counters[3] << std::endl;
+
+  // Systems with more state than std::function keeps inline, 32 bytes here,
+  // which it then puts on the heap among the other allocations made while
+  // the systems are set up.
+  uint64_t large_count = 1 << 12;
+  uint64_t rounds = 1 << 10;
+  std::vector<float> outputs(large_count, 0.0f);
+  float* out = outputs.data();
+  std::vector<std::function<void(radiance::Frame*)>> large_functions;
+  std::vector<radiance::System> large_systems;
+  std::vector<std::vector<uint8_t>> other;
+  for (uint64_t i = 0; i < large_count; ++i) {
+    float a = (float)i;
+    float b = 0.5f;
+    float c = 2.0f;
+    auto f = [out, i, a, b, c](radiance::Frame*) { out[i] += a * b + c; };
+    large_functions.push_back(f);
+    large_systems.push_back(f);
+    other.emplace_back(64 + i % 256);
+  }
+
+  timer.start();
+  for (uint64_t r = 0; r < rounds; ++r) {
+    for (auto& f : large_functions) {
+      f(&frame);
+    }
+  }
+  timer.stop();
+  double function_call = timer.get_elapsed_ns() / (double)(large_count * rounds);
+  timer.start();
+  for (uint64_t r = 0; r < rounds; ++r) {
+    for (auto& s : large_systems) {
+      s(&frame);
+    }
+  }
+  timer.stop();
+  double system_call = timer.get_elapsed_ns() / (double)(large_count * rounds);
+  std::cout << "large std::function avg ns per call: " << function_call
+            << ", System: " << system_call << std::endl;
+
+  // Every push into a SystemExecutor copies the system.
+  timer.start();
+  std::vector<std::function<void(radiance::Frame*)>> function_copy =
+      large_functions;
+  timer.stop();
+  double function_copy_ns = timer.get_elapsed_ns() / (double)large_count;
+  timer.start();
+  std::vector<radiance::System> system_copy = large_systems;
+  timer.stop();
+  double system_copy_ns = timer.get_elapsed_ns() / (double)large_count;
+  std::cout << "large std::function avg ns per copy: " << function_copy_ns
+            << ", System: " << system_copy_ns << std::endl;
+  std::cout << "checksum: " << outputs[1] + function_copy.size() +
+                               system_copy.size() << std::endl;
+
+  // A system pushed without an Access runs with the Frame passed in, so the
+  // callback sees what it pushed.
+  bool shared_frame = false;
+  bool* seen = &shared_frame;
+  radiance::SystemExecutor exclusive([seen](radiance::Frame* frame) {
+    *seen = *frame->peek<int>() == 42;
+    frame->pop();
+  });
+  exclusive.push([](radiance::Frame* frame) { frame->push(42); });
+  exclusive(&frame);
+  std::cout << "exclusive systems share the frame: " << shared_frame
+            << std::endl;
+
+  // Push and erase many systems by id.
+  uint64_t churn = 1 << 16;
+  radiance::SystemExecutor removable;
+  std::vector<radiance::Id> ids;
+  for (uint64_t i = 0; i < churn; ++i) {
+    ids.push_back(removable.push([](radiance::Frame*) {}));
+  }
+  timer.start();
+  for (uint64_t i = 0; i < churn; i += 2) {
+    removable.erase(ids[i]);
+  }
+  timer.stop();
+  std::cout << "erase avg ns: " << timer.get_elapsed_ns() / (churn / 2)
+            << ", systems left: " << removable.size()
+            << ", stages: " << removable.stages() << std::endl;
+  return 0;
+}
@@ -96,6 +96,9 @@ int main(int, char* []) {
   add_particle_pipeline(kParticleCollection);
   add_render_pipeline();
 
+  // Keep the particles sorted spatially with at most 0.5ms a frame.
+  radiance::set_reorder_budget(500000);
+
   radiance::start();
   while (1) {
     if (XCheckWindowEvent(dpy, win, KeyPressMask, &xev)) {
@@ -3,13 +3,36 @@
 
 #include "particles.h"
 
+namespace {
+
+// Spreads the lower 21 bits of x so that there are two zero bits between each.
+uint64_t spread_bits(uint64_t x) {
+  x &= 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffff;
+  x = (x | x << 16) & 0x1f0000ff0000ff;
+  x = (x | x << 8) & 0x100f00f00f00f00f;
+  x = (x | x << 4) & 0x10c30c30c30c30c3;
+  x = (x | x << 2) & 0x1249249249249249;
+  return x;
+}
+
+// Orders particles along a Z-order curve over the [-1, 1] cube so that
+// particles close in space are close in memory.
+uint64_t morton_code(const Particles::Key&, const Particles::Value& value) {
+  const float scale = (float)0x1fffff / 2.0f;
+  uint64_t x = (uint64_t)((glm::clamp(value.p.x, -1.0f, 1.0f) + 1.0f) * scale);
+  uint64_t y = (uint64_t)((glm::clamp(value.p.y, -1.0f, 1.0f) + 1.0f) * scale);
+  uint64_t z = (uint64_t)((glm::clamp(value.p.z, -1.0f, 1.0f) + 1.0f) * scale);
+  return spread_bits(x) | spread_bits(y) << 1 | spread_bits(z) << 2;
+}
+
+}  // namespace
+
 radiance::Collection* add_particle_collection(const char* collection, uint64_t particle_count) {
   radiance::Collection* particles =
       radiance::add_collection(kMainProgram, collection);
 
   Particles::Table* table = new Particles::Table();
-  table->keys.reserve(particle_count);
-  table->values.reserve(particle_count);
 
   for (uint64_t i = 0; i < particle_count; ++i) {
     glm::vec3 p{
@@ -26,13 +49,14 @@ radiance::Collection* add_particle_collection(const char* collection, uint64_t p
 
     table->insert(i, {p, v});
   }
+  table->set_locality(morton_code);
 
   radiance::Copy copy =
       [](const uint8_t*, const uint8_t* value, uint64_t offset,
          radiance::Stack* stack) {
         radiance::Mutation* mutation = (radiance::Mutation*)stack->alloc(
             sizeof(radiance::Mutation) + sizeof(Particles::Element));
-        mutation->element = (uint8_t*)(mutation + sizeof(radiance::Mutation));
+        mutation->element = (uint8_t*)(mutation + 1);
         mutation->mutate_by = radiance::MutateBy::UPDATE;
         Particles::Element* el =
             (Particles::Element*)(mutation->element);
@@ -54,11 +78,19 @@ radiance::Collection* add_particle_collection(const char* collection, uint64_t p
   particles->count = [](radiance::Collection* c) -> uint64_t {
     return ((Particles::Table*)c->collection)->size();
   };
+  particles->reorder = [](radiance::Collection* c, uint64_t budget_ns) {
+    ((Particles::Table*)c->collection)->reorder(budget_ns);
+  };
+  particles->load = [](radiance::Collection* c, const uint8_t* keys,
+                       const uint8_t* values, uint64_t count) {
+    Particles::Table* t = (Particles::Table*)c->collection;
+    t->assign((const Particles::Key*)keys, (const Particles::Value*)values, count);
+  };
+  particles->bind = radiance::bind_table<Particles::Table>;
+  particles->shrink = radiance::shrink_table<Particles::Table>;
 
-  particles->keys.data = (uint8_t*)table->keys.data();
   particles->keys.size = sizeof(Particles::Key);
   particles->keys.offset = 0;
-  particles->values.data = (uint8_t*)table->values.data();
   particles->values.size = sizeof(Particles::Value);
   particles->values.offset = 0;
   return particles;
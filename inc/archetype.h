@@ -0,0 +1,272 @@
+/**
+* Author: Samuel Rohde (rohde.samuel@gmail.com)
+*
+* This file is subject to the terms and conditions defined in
+* file 'LICENSE.txt', which is part of this source code package.
+*/
+
+#ifndef ARCHETYPE__H
+#define ARCHETYPE__H
+
+#include "radiance.h"
+#include "stack_memory.h"
+#include "table.h"
+
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace radiance
+{
+
+// The components of one entity, stored together. Each component type may
+// only appear once. Use get<Component>(components) to access one.
+template<typename... Components_>
+struct Components;
+
+template<>
+struct Components<> {};
+
+template<typename Head_, typename... Tail_>
+struct Components<Head_, Tail_...> : Components<Tail_...> {
+  Head_ head;
+};
+
+template<typename Component_, typename... Tail_>
+inline Component_& get(Components<Component_, Tail_...>& components) {
+  return components.head;
+}
+
+template<typename Component_, typename... Tail_>
+inline const Component_& get(const Components<Component_, Tail_...>& components) {
+  return components.head;
+}
+
+// Whether Component_ is one of Components_.
+template<typename Component_, typename... Components_>
+struct Contains : std::false_type {};
+
+template<typename Component_, typename Head_, typename... Tail_>
+struct Contains<Component_, Head_, Tail_...> :
+    std::integral_constant<bool, std::is_same<Component_, Head_>::value ||
+                                 Contains<Component_, Tail_...>::value> {};
+
+// Whether all of Query_ are in Components_.
+template<typename Query_, typename... Components_>
+struct ContainsAll;
+
+template<typename... Components_>
+struct ContainsAll<Components<>, Components_...> : std::true_type {};
+
+template<typename Head_, typename... Tail_, typename... Components_>
+struct ContainsAll<Components<Head_, Tail_...>, Components_...> :
+    std::integral_constant<bool, Contains<Head_, Components_...>::value &&
+                                 ContainsAll<Components<Tail_...>, Components_...>::value> {};
+
+// All entities with exactly the components Components_ share one Archetype.
+// Their components are stored together, one row per entity, so a pipeline
+// over several components walks one contiguous array instead of joining a
+// collection per component.
+//
+// An Archetype registers itself as a collection with add_collection, so it
+// can be used as the source and sink of any pipeline. Use Query to add
+// pipelines over every Archetype that has a given set of components.
+template<typename Key_, typename... Components_>
+class Archetype {
+public:
+  typedef Key_ Key;
+  typedef radiance::Components<Components_...> Value;
+  typedef radiance::Table<Key, Value> Table;
+  typedef typename Table::Element Element;
+
+  template<typename Component_>
+  using Has = Contains<Component_, Components_...>;
+
+  template<typename... Query_>
+  using Matches = ContainsAll<radiance::Components<Query_...>, Components_...>;
+
+  Archetype(const char* program, const char* name) :
+      program_(program), name_(name) {
+    collection_ = add_collection(program, name_.c_str());
+    if (!collection_) {
+      return;
+    }
+    collection_->collection = &table_;
+    collection_->copy = copy;
+    collection_->mutate = mutate;
+    collection_->count = count;
+    collection_->reorder = reorder;
+    collection_->load = load;
+    collection_->bind = bind_table<Table>;
+    collection_->shrink = shrink_table<Table>;
+    collection_->keys.size = sizeof(Key);
+    collection_->keys.offset = 0;
+    collection_->values.size = sizeof(Value);
+    collection_->values.offset = 0;
+  }
+
+  Archetype(const Archetype&) = delete;
+  Archetype& operator=(const Archetype&) = delete;
+
+  Handle insert(const Key& key, const Components_&... components) {
+    Value value;
+    int assign[] = {0, (radiance::get<Components_>(value) = components, 0)...};
+    (void)assign;
+    return insert(key, std::move(value));
+  }
+
+  Handle insert(const Key& key, Value&& value) {
+    return table_.insert(key, std::move(value));
+  }
+
+  void remove(Handle handle) {
+    table_.remove(handle);
+  }
+
+  template<typename Component_>
+  inline Component_& get(Handle handle) {
+    return radiance::get<Component_>(table_[handle]);
+  }
+
+  template<typename Component_>
+  inline const Component_& get(Handle handle) const {
+    return radiance::get<Component_>(table_[handle]);
+  }
+
+  // Moves the entity at handle in from to this archetype. Components that
+  // both archetypes have are copied, the others are taken from init. Returns
+  // the entity's handle in this archetype.
+  template<typename From_>
+  Handle migrate(From_* from, Handle handle, Value init = Value()) {
+    const typename From_::Value& src = (*from->table())[handle];
+    int copy[] = {0, (copy_component<Components_>(
+        src, &init, typename From_::template Has<Components_>()), 0)...};
+    (void)copy;
+
+    Key key = from->table()->key(from->table()->row(handle));
+    from->remove(handle);
+    return insert(key, std::move(init));
+  }
+
+  inline Table* table() {
+    return &table_;
+  }
+
+  inline const Table* table() const {
+    return &table_;
+  }
+
+  inline Collection* collection() {
+    return collection_;
+  }
+
+  inline const char* program() const {
+    return program_;
+  }
+
+  inline const char* name() const {
+    return name_.c_str();
+  }
+
+  inline uint64_t size() const {
+    return table_.size();
+  }
+
+private:
+  template<typename Component_, typename Source_>
+  static void copy_component(const Source_& src, Value* dst, std::true_type) {
+    radiance::get<Component_>(*dst) = radiance::get<Component_>(src);
+  }
+
+  template<typename Component_, typename Source_>
+  static void copy_component(const Source_&, Value*, std::false_type) {}
+
+  static void copy(const uint8_t*, const uint8_t* value, uint64_t offset,
+                   Stack* stack) {
+    Mutation* mutation =
+        (Mutation*)stack->alloc(sizeof(Mutation) + sizeof(Element));
+    mutation->element = (uint8_t*)(mutation + 1);
+    mutation->mutate_by = MutateBy::UPDATE;
+    Element* el = (Element*)(mutation->element);
+    el->indexed_by = IndexedBy::OFFSET;
+    el->offset = offset;
+    new (&el->value) Value(*(const Value*)value);
+  }
+
+  static void mutate(Collection* c, const Mutation* m) {
+    Element* el = (Element*)(m->element);
+    ((Table*)c->collection)->update_at(el->offset, std::move(el->value));
+  }
+
+  static uint64_t count(Collection* c) {
+    return ((Table*)c->collection)->size();
+  }
+
+  static void reorder(Collection* c, uint64_t budget_ns) {
+    ((Table*)c->collection)->reorder(budget_ns);
+  }
+
+  static void load(Collection* c, const uint8_t* keys, const uint8_t* values,
+                   uint64_t count) {
+    ((Table*)c->collection)->assign((const Key*)keys, (const Value*)values, count);
+  }
+
+  const char* program_;
+  std::string name_;
+  Table table_;
+  Collection* collection_ = nullptr;
+};
+
+// Adds pipelines that run over the components Query_ of every entity of the
+// archetypes that have all of them, e.g.
+//
+//   void integrate(Position& p, Velocity& v);
+//   Query<Position, Velocity>::add_pipelines<integrate>("main", &a, &b, &c);
+//
+// adds one pipeline per archetype out of a, b, and c that has both a
+// Position and a Velocity. The pipelines still have to be enabled.
+template<typename... Query_>
+struct Query {
+  typedef void (*Function)(Query_&...);
+
+  template<Function F_, typename... Archetypes_>
+  static std::vector<Pipeline*> add_pipelines(const char* program,
+                                              Archetypes_*... archetypes) {
+    std::vector<Pipeline*> pipelines;
+    int add[] = {0, (add_pipeline_if<F_>(
+        program, archetypes, &pipelines,
+        typename Archetypes_::template Matches<Query_...>()), 0)...};
+    (void)add;
+    return pipelines;
+  }
+
+  // The Transform that calls F_ with the components of one entity.
+  template<typename Archetype_, Function F_>
+  static void transform(Stack* stack) {
+    typename Archetype_::Element* el = (typename Archetype_::Element*)
+        ((Mutation*)(stack->top()))->element;
+    F_(radiance::get<Query_>(el->value)...);
+  }
+
+private:
+  template<Function F_, typename Archetype_>
+  static void add_pipeline_if(const char* program, Archetype_* archetype,
+                              std::vector<Pipeline*>* pipelines,
+                              std::true_type) {
+    Pipeline* pipeline =
+        add_pipeline(program, archetype->name(), archetype->name());
+    if (pipeline) {
+      pipeline->transform = transform<Archetype_, F_>;
+      pipelines->push_back(pipeline);
+    }
+  }
+
+  template<Function F_, typename Archetype_>
+  static void add_pipeline_if(const char*, Archetype_*, std::vector<Pipeline*>*,
+                              std::false_type) {}
+};
+
+}  // namespace radiance
+
+#endif  // ARCHETYPE__H
@@ -0,0 +1,167 @@
+/**
+* Author: Samuel Rohde (rohde.samuel@gmail.com)
+*
+* This file is subject to the terms and conditions defined in
+* file 'LICENSE.txt', which is part of this source code package.
+*/
+
+#ifndef ARENA__H
+#define ARENA__H
+
+#include "common.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+namespace radiance
+{
+
+// A linear allocator over a list of chunks. Allocating bumps a pointer and
+// only touches the heap when the current chunk is full. Memory is released
+// all at once, either back to a Marker or with reset().
+//
+// Not thread safe. Use one Arena per thread.
+class Arena {
+public:
+  static const size_t DEFAULT_CHUNK_SIZE = 4096;
+
+  struct Stats {
+    // Bytes held in chunks.
+    uint64_t capacity;
+
+    // Most bytes in use at once, over the life of the arena and over the
+    // frame before the last reset().
+    uint64_t high_water;
+    uint64_t frame_high_water;
+
+    uint64_t chunk_allocations;
+    uint64_t resets;
+  };
+
+  // A position in the arena to rewind to.
+  struct Marker {
+    size_t chunk;
+    uint8_t* top;
+  };
+
+  Arena(size_t chunk_size = DEFAULT_CHUNK_SIZE) : chunk_size_(chunk_size) {
+    add_chunk(chunk_size_);
+    top_ = chunks_[0].begin;
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  ~Arena() {
+    for (Chunk& c : chunks_) {
+      free(c.begin);
+    }
+  }
+
+  // Align must be a power of two.
+  inline void* alloc(size_t size, size_t align) {
+    uint8_t* p = (uint8_t*)(((uintptr_t)top_ + align - 1) & ~(uintptr_t)(align - 1));
+    if (p + size > chunks_[chunk_].end) {
+      return alloc_slow(size, align);
+    }
+    top_ = p + size;
+    return p;
+  }
+
+  inline Marker mark() const {
+    return Marker{chunk_, top_};
+  }
+
+  // Releases everything allocated after marker was taken.
+  inline void rewind(Marker marker) {
+    record_high_water();
+    chunk_ = marker.chunk;
+    top_ = marker.top;
+  }
+
+  // Releases everything. Call at the end of a frame. If the frame needed more
+  // than one chunk they are replaced by a single chunk that fits all of it,
+  // so steady state frames stay in one chunk.
+  void reset() {
+    record_high_water();
+    if (chunks_.size() > 1) {
+      size_t capacity = stats_.capacity;
+      for (Chunk& c : chunks_) {
+        free(c.begin);
+      }
+      chunks_.clear();
+      stats_.capacity = 0;
+      add_chunk(capacity);
+    }
+    chunk_ = 0;
+    top_ = chunks_[0].begin;
+    stats_.frame_high_water = frame_high_water_;
+    frame_high_water_ = 0;
+    ++stats_.resets;
+  }
+
+  inline const Stats& stats() const {
+    return stats_;
+  }
+
+  // Bytes in use.
+  inline uint64_t size() const {
+    return chunks_[chunk_].offset + (top_ - chunks_[chunk_].begin);
+  }
+
+private:
+  struct Chunk {
+    uint8_t* begin;
+    uint8_t* end;
+
+    // Bytes in the chunks before this one.
+    uint64_t offset;
+  };
+
+  void* alloc_slow(size_t size, size_t align) {
+    // Moves on to the next chunk that fits, allocating one if none does.
+    // Chunks double in size so that a frame only needs a few of them.
+    while (++chunk_ < chunks_.size()) {
+      Chunk& c = chunks_[chunk_];
+      uint8_t* p = (uint8_t*)(((uintptr_t)c.begin + align - 1) & ~(uintptr_t)(align - 1));
+      if (p + size <= c.end) {
+        top_ = p + size;
+        return p;
+      }
+    }
+
+    size_t last = chunks_.back().end - chunks_.back().begin;
+    size_t needed = size + align;
+    add_chunk(2 * last > needed ? 2 * last : needed);
+    chunk_ = chunks_.size() - 1;
+    top_ = chunks_[chunk_].begin;
+    return alloc(size, align);
+  }
+
+  void add_chunk(size_t size) {
+    uint8_t* begin = (uint8_t*)malloc(size);
+    DEBUG_ASSERT(begin, Status::Code::MEMORY_OUT_OF_BOUNDS);
+    chunks_.push_back(Chunk{begin, begin + size, stats_.capacity});
+    stats_.capacity += size;
+    ++stats_.chunk_allocations;
+  }
+
+  inline void record_high_water() {
+    uint64_t used = size();
+    frame_high_water_ = used > frame_high_water_ ? used : frame_high_water_;
+    stats_.high_water = used > stats_.high_water ? used : stats_.high_water;
+  }
+
+  std::vector<Chunk> chunks_;
+  size_t chunk_ = 0;
+  uint8_t* top_ = nullptr;
+
+  size_t chunk_size_;
+  uint64_t frame_high_water_ = 0;
+  Stats stats_ = {};
+};
+
+}  // namespace radiance
+
+#endif  // ARENA__H
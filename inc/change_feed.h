@@ -0,0 +1,256 @@
+#ifndef CHANGE_FEED__H
+#define CHANGE_FEED__H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "radiance.h"
+#include "ring.h"
+#include "table.h"
+
+namespace radiance
+{
+
+// Publishes what changed in a Table every frame to consumers on other
+// threads, e.g. for replication or analytics. The feed attaches to the Table
+// like a secondary index, so it records inserts, removes, and updates as
+// they happen instead of diffing the table. At the end of every loop() the
+// frame's changes are copied as one batch into each subscriber's ring:
+//
+//   ChangeFeed<Table> feed(&table);
+//   c->publish = ChangeFeed<Table>::publish_collection;
+//   c->feed = &feed;
+//
+//   // On a consumer thread.
+//   ChangeFeed<Table>::Subscriber* subscriber = feed.subscribe();
+//   subscriber->poll([](const ChangeFeed<Table>::Change& change) { ... });
+//
+// Each subscriber reads at its own pace. A batch that does not fit into a
+// subscriber's ring is dropped for that subscriber and counted in lost(), so
+// a slow consumer never holds up the frame.
+//
+// Like the secondary indexes, the feed only sees changes made through the
+// Table's insert, remove, update, and assign, one thread at a time. Mutate
+// hooks should use Table::update_at, and pipelines writing into the table
+// should run in ExecutionMode::DETERMINISTIC.
+template<typename Table_>
+class ChangeFeed {
+public:
+  typedef Table_ Table;
+  typedef typename Table::Key Key;
+  typedef typename Table::Value Value;
+
+  enum class Kind : uint8_t {
+    INSERTED,
+    UPDATED,
+    // Carries the value the element had when it was removed.
+    REMOVED,
+    // The table was replaced, e.g. by a snapshot. Followed by an INSERTED
+    // change for every element.
+    CLEARED,
+  };
+
+  // Several updates to an element in one frame are published as one change
+  // with the last value.
+  struct Change {
+    uint64_t frame;
+    Kind kind;
+    Handle handle;
+    Key key;
+    Value value;
+  };
+
+  struct Stats {
+    uint64_t subscribers;
+
+    // Changes recorded, and the batches they were published in.
+    uint64_t changes;
+    uint64_t batches;
+
+    // Changes copied into subscribers' rings, and batches dropped because a
+    // ring was full.
+    uint64_t delivered;
+    uint64_t lost;
+    uint64_t publish_ns;
+  };
+
+  // Only to be read by one thread at a time.
+  class Subscriber {
+  public:
+    explicit Subscriber(uint64_t capacity) : ring_(capacity) {}
+
+    // Calls f(const Change&) on every published change, oldest first.
+    // Returns the number of changes.
+    template<typename Function_>
+    uint64_t poll(Function_ f) {
+      return ring_.consume_all([&f](Change& change) {
+        f((const Change&)change);
+      });
+    }
+
+    // Batches this subscriber missed. Once this grows the subscriber is out
+    // of date and should start over, e.g. from a snapshot.
+    uint64_t lost() const {
+      return lost_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    friend class ChangeFeed;
+
+    SpscRing<Change> ring_;
+    std::atomic<uint64_t> lost_{0};
+  };
+
+  // The elements already in the table are published as INSERTED changes with
+  // the first batch.
+  explicit ChangeFeed(Table* table) : table_(table) {
+    table_->add_index(this);
+  }
+
+  ChangeFeed(const ChangeFeed&) = delete;
+  ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+  ~ChangeFeed() {
+    table_->remove_index(this);
+  }
+
+  // Each subscriber's ring holds up to capacity changes between polls. Safe
+  // to call from any thread, also while publishing. The subscriber sees every
+  // batch published after this returns.
+  Subscriber* subscribe(uint64_t capacity = 1 << 16) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    subscribers_.emplace_back(new Subscriber(capacity));
+    return subscribers_.back().get();
+  }
+
+  // The subscriber must not be polled afterwards.
+  void unsubscribe(Subscriber* subscriber) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    subscribers_.erase(
+        std::remove_if(subscribers_.begin(), subscribers_.end(),
+                       [subscriber](const std::unique_ptr<Subscriber>& s) {
+                         return s.get() == subscriber;
+                       }),
+        subscribers_.end());
+  }
+
+  // Hands the changes recorded since the last call to every subscriber as
+  // one batch. Returns the number of changes.
+  uint64_t publish() {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t count = batch_.size();
+    if (count) {
+      for (auto& subscriber : subscribers_) {
+        SpscRing<Change>& ring = subscriber->ring_;
+        if (ring.capacity() - ring.size() < count) {
+          subscriber->lost_.store(subscriber->lost_.load(
+              std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+          ++lost_;
+          continue;
+        }
+        for (const Change& change : batch_) {
+          Change* slot = ring.claim();
+          new (slot) Change(change);
+          slot->frame = frame_;
+        }
+        ring.publish();
+        delivered_ += count;
+      }
+      ++batches_;
+    }
+    for (const Change& change : batch_) {
+      if (change.kind != Kind::CLEARED) {
+        pending_[handle_slot(change.handle)] = 0;
+      }
+    }
+    changes_ += count;
+    batch_.clear();
+    ++frame_;
+    publish_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start).count();
+    return count;
+  }
+
+  // A Publish hook for a Collection whose feed is a ChangeFeed<Table>.
+  static uint64_t publish_collection(Collection* c) {
+    return ((ChangeFeed*)c->feed)->publish();
+  }
+
+  Stats stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats ret = {};
+    ret.subscribers = subscribers_.size();
+    ret.changes = changes_;
+    ret.batches = batches_;
+    ret.delivered = delivered_;
+    ret.lost = lost_;
+    ret.publish_ns = publish_ns_;
+    return ret;
+  }
+
+  // Called by the Table.
+  void insert(Handle handle, const Value& value) {
+    record(Kind::INSERTED, handle, table_->key(table_->row(handle)), value);
+  }
+
+  // Called by the Table.
+  void remove(Handle handle, const Value& value) {
+    record(Kind::REMOVED, handle, table_->key(table_->row(handle)), value);
+    pending_[handle_slot(handle)] = 0;
+  }
+
+  // Called by the Table.
+  void update(Handle handle, const Value&, const Value& new_value) {
+    uint64_t slot = handle_slot(handle);
+    if (slot < pending_.size() && pending_[slot]) {
+      batch_[pending_[slot] - 1].value = new_value;
+      return;
+    }
+    record(Kind::UPDATED, handle, table_->key(table_->row(handle)),
+           new_value);
+  }
+
+  // Called by the Table.
+  void clear() {
+    batch_.clear();
+    std::fill(pending_.begin(), pending_.end(), 0);
+    batch_.push_back(Change{0, Kind::CLEARED, -1, Key(), Value()});
+  }
+
+private:
+  void record(Kind kind, Handle handle, const Key& key, const Value& value) {
+    uint64_t slot = handle_slot(handle);
+    if (pending_.size() <= slot) {
+      pending_.resize(slot + 1);
+    }
+    batch_.push_back(Change{0, kind, handle, key, value});
+    pending_[slot] = batch_.size();
+  }
+
+  Table* table_;
+
+  // The changes since the last publish(), and for each handle's slot the
+  // position after its latest change in the batch, or 0 if it has none.
+  std::vector<Change> batch_;
+  std::vector<uint64_t> pending_;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Subscriber>> subscribers_;
+
+  uint64_t frame_ = 0;
+  uint64_t changes_ = 0;
+  uint64_t batches_ = 0;
+  uint64_t delivered_ = 0;
+  uint64_t lost_ = 0;
+  uint64_t publish_ns_ = 0;
+};
+
+}  // namespace radiance
+
+#endif  // CHANGE_FEED__H
@@ -74,6 +74,26 @@ struct __CACHE_ALIGNED__ CacheAlligned {
 #endif
 
 typedef int64_t Handle;
+
+// A Handle packs a slot in its low 32 bits and the generation of that slot in
+// the 31 bits above. A slot's generation changes whenever its element is
+// removed, so a stale handle to a reused slot is told apart in O(1). Handles
+// are never negative, -1 is the invalid handle.
+const uint64_t HANDLE_SLOT_BITS = 32;
+const uint64_t HANDLE_SLOT_MASK = (1ull << HANDLE_SLOT_BITS) - 1;
+const uint32_t HANDLE_GENERATION_MASK = 0x7FFFFFFF;
+
+inline Handle pack_handle(uint64_t slot, uint32_t generation) {
+  return (Handle)(((uint64_t)(generation & HANDLE_GENERATION_MASK) << HANDLE_SLOT_BITS) | slot);
+}
+
+inline uint64_t handle_slot(Handle handle) {
+  return (uint64_t)handle & HANDLE_SLOT_MASK;
+}
+
+inline uint32_t handle_generation(Handle handle) {
+  return (uint32_t)((uint64_t)handle >> HANDLE_SLOT_BITS);
+}
 typedef int64_t Offset;
 typedef int64_t Id;
 
@@ -91,6 +111,8 @@ struct Status {
     DOES_NOT_EXIST,
     ALREADY_EXISTS,
     UNKNOWN_TRIGGER_POLICY,
+    IO_ERROR,
+    NONDETERMINISTIC,
   };
 
   Status(Code code=Code::OK, const char* message=""):
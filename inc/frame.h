@@ -3,6 +3,7 @@
 
 #include <functional>
 #include <iostream>
+#include <new>
 
 #include "common.h"
 #include "stack_memory.h"
@@ -18,18 +19,29 @@ private:
 public:
   template<typename Type_>
   Type_* push(const Type_& t) {
-    Type_* new_t = (Type_*)stack_.alloc(sizeof(Type_));
+    Type_* new_t = (Type_*)stack_.alloc(sizeof(Type_), alignof(Type_));
     new (new_t) Type_(t);
     return new_t;
   }
 
   template<typename Type_>
   Type_* push(Type_&& t) {
-    Type_* new_t = (Type_*)stack_.alloc(sizeof(Type_));
+    Type_* new_t = (Type_*)stack_.alloc(sizeof(Type_), alignof(Type_));
     new (new_t) Type_(std::move(t));
     return new_t;
   }
 
+  // Pushes count default initialized Type_ as one value.
+  template<typename Type_>
+  Type_* push_array(size_t count) {
+    return stack_.alloc_array<Type_>(count);
+  }
+
+  // Pushes size bytes aligned to align.
+  void* push_bytes(size_t size, size_t align) {
+    return stack_.alloc(size, align);
+  }
+
   void pop() {
     stack_.free();
   }
@@ -42,6 +54,16 @@ public:
   void clear() {
     stack_.clear();
   }
+
+  // Clears the frame and releases what its stack grew into. Call once at the
+  // end of every frame.
+  void reset() {
+    stack_.reset();
+  }
+
+  inline const Arena::Stats& stats() const {
+    return stack_.stats();
+  }
 };
 
 }  // namespace radiance
@@ -0,0 +1,172 @@
+#ifndef INGEST__H
+#define INGEST__H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "radiance.h"
+#include "ring.h"
+#include "table.h"
+
+namespace radiance
+{
+
+// Streams mutations into a Table from other threads, e.g. network threads.
+// Every producer thread gets its own bounded ring, so producers never
+// contend with each other. The rings are merged into the table at the start
+// of every loop(), before any prepare hook or pipeline runs:
+//
+//   Ingest<Table> ingest;
+//   c->merge = Ingest<Table>::merge_collection;
+//   c->ingest = &ingest;
+//
+//   // On a network thread.
+//   Ingest<Table>::Producer* producer = ingest.add_producer();
+//   producer->emplace<MutateBy::UPDATE, IndexedBy::KEY>(key, std::move(value));
+//
+// Mutations are built in place in the ring and applied from there. A
+// producer applies back pressure by checking the result of emplace(), since
+// a full ring rejects the mutation.
+template<typename Table_>
+class Ingest {
+public:
+  typedef Table_ Table;
+  typedef typename Table::Mutation Mutation;
+
+  struct Stats {
+    uint64_t producers;
+
+    // Mutations published by producers, and those rejected by a full ring.
+    uint64_t pushed;
+    uint64_t rejected;
+
+    // Mutations applied, by how many merges, and the most in one merge.
+    uint64_t merged;
+    uint64_t merges;
+    uint64_t max_batch;
+    uint64_t merge_ns;
+  };
+
+  // Only to be used by the thread that added it.
+  class Producer {
+  public:
+    explicit Producer(uint64_t capacity) : ring_(capacity) {}
+
+    // Returns memory for the next mutation, to be built with placement new,
+    // or nullptr if the ring is full. Claimed mutations are applied only
+    // after publish(), so a batch can be published at once.
+    Mutation* claim() {
+      Mutation* m = ring_.claim();
+      if (m) {
+        ++claimed_;
+      } else {
+        rejected_.store(rejected_.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+      }
+      return m;
+    }
+
+    void publish() {
+      pushed_.store(claimed_, std::memory_order_relaxed);
+      ring_.publish();
+    }
+
+    bool push(Mutation&& m) {
+      Mutation* slot = claim();
+      if (!slot) {
+        return false;
+      }
+      new (slot) Mutation(std::move(m));
+      publish();
+      return true;
+    }
+
+    template<MutateBy mutate_by, IndexedBy indexed_by, typename IndexType_>
+    bool emplace(IndexType_&& index, typename Table::Value&& value) {
+      Mutation* slot = claim();
+      if (!slot) {
+        return false;
+      }
+      new (slot) Mutation{mutate_by, {indexed_by, std::move(index),
+                                      std::move(value)}};
+      publish();
+      return true;
+    }
+
+  private:
+    friend class Ingest;
+
+    SpscRing<Mutation> ring_;
+    uint64_t claimed_ = 0;
+    std::atomic<uint64_t> pushed_{0};
+    std::atomic<uint64_t> rejected_{0};
+  };
+
+  // Each producer's ring holds up to capacity mutations between merges.
+  explicit Ingest(uint64_t capacity = 1 << 14) : capacity_(capacity) {}
+
+  // Safe to call from any thread, also while merging.
+  Producer* add_producer() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    producers_.emplace_back(new Producer(capacity_));
+    return producers_.back().get();
+  }
+
+  // Applies every published mutation, producer by producer. Each producer's
+  // mutations are applied in the order they were published.
+  uint64_t merge(Table* table) {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t count = 0;
+    for (auto& producer : producers_) {
+      count += producer->ring_.consume_all([table](Mutation& m) {
+        MutationBuffer<Table>::resolve(table, std::move(m));
+      });
+    }
+    merged_ += count;
+    ++merges_;
+    max_batch_ = std::max(max_batch_, count);
+    merge_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start).count();
+    return count;
+  }
+
+  // A Merge hook for a Collection whose ingest is an Ingest<Table>.
+  static uint64_t merge_collection(Collection* c) {
+    return ((Ingest*)c->ingest)->merge((Table*)c->collection);
+  }
+
+  Stats stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats ret = {};
+    ret.producers = producers_.size();
+    for (auto& producer : producers_) {
+      ret.pushed += producer->pushed_.load(std::memory_order_relaxed);
+      ret.rejected += producer->rejected_.load(std::memory_order_relaxed);
+    }
+    ret.merged = merged_;
+    ret.merges = merges_;
+    ret.max_batch = max_batch_;
+    ret.merge_ns = merge_ns_;
+    return ret;
+  }
+
+private:
+  const uint64_t capacity_;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Producer>> producers_;
+
+  uint64_t merged_ = 0;
+  uint64_t merges_ = 0;
+  uint64_t max_batch_ = 0;
+  uint64_t merge_ns_ = 0;
+};
+
+}  // namespace radiance
+
+#endif  // INGEST__H
@@ -0,0 +1,536 @@
+/**
+* Author: Samuel Rohde (rohde.samuel@gmail.com)
+*
+* This file is subject to the terms and conditions defined in
+* file 'LICENSE.txt', which is part of this source code package.
+*/
+
+#ifndef MAPPED_TABLE__H
+#define MAPPED_TABLE__H
+
+#include "common.h"
+#include "table.h"
+
+#ifdef __COMPILE_AS_LINUX__
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <type_traits>
+
+namespace radiance
+{
+
+// A fixed-size array that lives inside of a MappedTable's file.
+template<typename Type_>
+class MappedArray {
+public:
+  MappedArray() : data_(nullptr), size_(nullptr) {}
+
+  inline Type_* data() { return data_; }
+  inline const Type_* data() const { return data_; }
+
+  inline uint64_t size() const { return size_ ? *size_ : 0; }
+
+  inline Type_& operator[](uint64_t i) { return data_[i]; }
+  inline const Type_& operator[](uint64_t i) const { return data_[i]; }
+
+  inline Type_& back() { return data_[size() - 1]; }
+
+  inline Type_* begin() { return data_; }
+  inline Type_* end() { return data_ + size(); }
+  inline const Type_* begin() const { return data_; }
+  inline const Type_* end() const { return data_ + size(); }
+
+private:
+  template<typename, typename> friend class MappedTable;
+
+  Type_* data_;
+  const uint64_t* size_;
+};
+
+// A Table whose keys, values, and handles live in a memory-mapped file. The
+// file can be reopened after a restart and iterated immediately with the OS
+// paging data in lazily. The key to handle index is rebuilt on the first
+// lookup instead of on open. Handles are generational like a Table's, and
+// stay valid across a reopen. The table grows by writing a larger copy next
+// to the file and renaming it over the file, so a crash while growing leaves
+// either the old or the new table, never a mix of the two.
+//
+// File layout, each array aligned to a cache line:
+//   Header | keys[capacity] | values[capacity] | handles[capacity] |
+//   rows[capacity] | free_handles[capacity]
+template<typename Key_, typename Value_>
+class MappedTable {
+public:
+  static_assert(std::is_trivially_copyable<Key_>::value,
+                "MappedTable keys must be trivially copyable.");
+  static_assert(std::is_trivially_copyable<Value_>::value,
+                "MappedTable values must be trivially copyable.");
+
+  typedef Key_ Key;
+  typedef Value_ Value;
+
+  typedef BaseElement<Key, Value> Element;
+
+  typedef MappedArray<Key> Keys;
+  typedef MappedArray<Value> Values;
+
+  typedef std::map<Key, Handle> Index;
+
+  static const uint64_t MAGIC = 0x5244434D41505431;  // "RDCMAPT1"
+  static const uint32_t VERSION = 2;
+  static const uint64_t DEFAULT_CAPACITY = 1 << 10;
+
+  MappedTable() {}
+
+  MappedTable(const MappedTable&) = delete;
+  MappedTable& operator=(const MappedTable&) = delete;
+
+  ~MappedTable() {
+    close();
+  }
+
+  // Attaches to the table stored at path, or creates a new one if the file
+  // does not exist.
+  Status::Code open(const char* path, uint64_t capacity = DEFAULT_CAPACITY) {
+    close();
+
+    fd_ = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      return Status::DOES_NOT_EXIST;
+    }
+    path_ = path;
+
+    // A copy left over from a crash while growing was never put in place.
+    unlink((path_ + ".grow").data());
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      close();
+      return Status::IO_ERROR;
+    }
+
+    Status::Code status;
+    if (st.st_size == 0) {
+      status = create(capacity > 0 ? capacity : 1);
+    } else {
+      status = attach(st.st_size);
+    }
+
+    if (status != Status::OK) {
+      close();
+    }
+    return status;
+  }
+
+  // Flushes all dirty pages to the file. An asynchronous checkpoint only
+  // schedules the writes.
+  Status::Code checkpoint(bool async = false) {
+    if (!header_) {
+      return Status::BAD_RUN_STATE;
+    }
+    if (msync(header_, mapped_size_, async ? MS_ASYNC : MS_SYNC) != 0) {
+      return Status::IO_ERROR;
+    }
+    return Status::OK;
+  }
+
+  Status::Code close() {
+    Status::Code status = Status::OK;
+    if (header_) {
+      status = checkpoint();
+      munmap(header_, mapped_size_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+
+    header_ = nullptr;
+    mapped_size_ = 0;
+    fd_ = -1;
+    path_.clear();
+    index_.clear();
+    indexed_ = false;
+    bind();
+    return status;
+  }
+
+  inline bool is_open() const {
+    return header_ != nullptr;
+  }
+
+  // Grows the file so that it can hold at least capacity elements. This
+  // remaps the file, so any raw pointers into the table are invalidated.
+  Status::Code reserve(uint64_t capacity) {
+    if (!header_) {
+      return Status::BAD_RUN_STATE;
+    }
+    if (capacity <= header_->capacity) {
+      return Status::OK;
+    }
+
+    // Every array starts further in with the larger capacity, so the table
+    // is laid out anew in a file of its own, which is only put in place once
+    // it is complete and on disk.
+    std::string grow_path = path_ + ".grow";
+    int fd = ::open(grow_path.data(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      return Status::IO_ERROR;
+    }
+    uint64_t new_size = file_size(capacity);
+    void* addr = MAP_FAILED;
+    if (ftruncate(fd, new_size) == 0) {
+      addr = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      unlink(grow_path.data());
+      return Status::IO_ERROR;
+    }
+
+    uint8_t* base = (uint8_t*)addr;
+    const uint8_t* old_base = (const uint8_t*)header_;
+    uint64_t old_capacity = header_->capacity;
+    memcpy(base, old_base, sizeof(Header));
+    ((Header*)base)->capacity = capacity;
+    for (int i = KEYS; i < ARRAY_COUNT; ++i) {
+      memcpy(base + array_offset(i, capacity),
+             old_base + array_offset(i, old_capacity),
+             old_capacity * array_stride(i));
+    }
+
+    if (msync(addr, new_size, MS_SYNC) != 0 || fsync(fd) != 0 ||
+        rename(grow_path.data(), path_.data()) != 0) {
+      munmap(addr, new_size);
+      ::close(fd);
+      unlink(grow_path.data());
+      return Status::IO_ERROR;
+    }
+
+    munmap(header_, mapped_size_);
+    ::close(fd_);
+    fd_ = fd;
+    header_ = (Header*)addr;
+    mapped_size_ = new_size;
+    bind();
+
+    // Makes the rename itself durable.
+    return sync_directory() ? Status::OK : Status::IO_ERROR;
+  }
+
+  Handle insert(const Key& key, const Value& value) {
+    if (header_->size == header_->capacity) {
+      if (reserve(header_->capacity * 2) != Status::OK) {
+        return -1;
+      }
+    }
+
+    uint64_t row = header_->size;
+    Handle handle = make_handle(row);
+    if (indexed_) {
+      index_[key] = handle;
+    }
+
+    keys.data_[row] = key;
+    values.data_[row] = value;
+    rows_[row] = handle;
+    ++header_->size;
+    return handle;
+  }
+
+  // Unchecked, the handle must be valid.
+  Value& operator[](Handle handle) {
+    return values[handles_[handle_slot(handle)].row];
+  }
+
+  const Value& operator[](Handle handle) const {
+    return values[handles_[handle_slot(handle)].row];
+  }
+
+  // Whether handle refers to an element that is still in the table.
+  inline bool valid(Handle handle) const {
+    uint64_t slot = handle_slot(handle);
+    return handle >= 0 && header_ && slot < header_->handle_count &&
+           handles_[slot].generation == handle_generation(handle);
+  }
+
+  // Returns nullptr if the handle is stale.
+  inline Value* get(Handle handle) {
+    return valid(handle) ? &values[handles_[handle_slot(handle)].row] : nullptr;
+  }
+
+  inline const Value* get(Handle handle) const {
+    return valid(handle) ? &values[handles_[handle_slot(handle)].row] : nullptr;
+  }
+
+  Handle find(const Key& key) const {
+    if (!indexed_) {
+      build_index();
+    }
+
+    typename Index::const_iterator it = index_.find(key);
+    if (it != index_.end()) {
+      return it->second;
+    }
+    return -1;
+  }
+
+  inline Key& key(uint64_t index) {
+    return keys[index];
+  }
+
+  inline const Key& key(uint64_t index) const {
+    return keys[index];
+  }
+
+  inline Value& value(uint64_t index) {
+    return values[index];
+  }
+
+  inline const Value& value(uint64_t index) const {
+    return values[index];
+  }
+
+  uint64_t size() const {
+    return header_ ? header_->size : 0;
+  }
+
+  uint64_t capacity() const {
+    return header_ ? header_->capacity : 0;
+  }
+
+  inline uint64_t row(Handle handle) const {
+    return handles_[handle_slot(handle)].row;
+  }
+
+  inline Handle handle(uint64_t index) const {
+    return rows_[index];
+  }
+
+  // Returns -1 if the handle is stale.
+  int64_t remove(Handle handle) {
+    if (!valid(handle)) {
+      return -1;
+    }
+    uint64_t row = handles_[handle_slot(handle)].row;
+    uint64_t last = header_->size - 1;
+    Handle moved = rows_[last];
+
+    if (indexed_) {
+      index_.erase(keys[row]);
+    }
+    release_handle(handle);
+
+    keys[row] = keys[last];
+    values[row] = values[last];
+    handles_[handle_slot(moved)].row = row;
+    rows_[row] = moved;
+    --header_->size;
+    return 0;
+  }
+
+  Keys keys;
+  Values values;
+
+private:
+  // Maps a handle's slot to its row and the slot's current generation.
+  struct Slot {
+    uint64_t row;
+    uint32_t generation;
+  };
+
+  struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t reserved;
+    uint64_t capacity;
+    uint64_t size;
+    uint64_t handle_count;
+    uint64_t free_count;
+  };
+
+  enum Array {
+    HEADER = 0,
+    KEYS,
+    VALUES,
+    HANDLES,
+    ROWS,
+    FREE_HANDLES,
+    ARRAY_COUNT,
+  };
+
+  static uint64_t align(uint64_t n) {
+    return (n + CACHE_LINE_SIZE - 1) & ~(uint64_t)(CACHE_LINE_SIZE - 1);
+  }
+
+  static uint64_t array_stride(int array) {
+    switch (array) {
+      case KEYS: return sizeof(Key);
+      case VALUES: return sizeof(Value);
+      case HANDLES: return sizeof(Slot);
+      case ROWS: return sizeof(Handle);
+      case FREE_HANDLES: return sizeof(uint64_t);
+      default: return 0;
+    }
+  }
+
+  static uint64_t array_offset(int array, uint64_t capacity) {
+    uint64_t offset = align(sizeof(Header));
+    for (int i = KEYS; i < array; ++i) {
+      offset += align(capacity * array_stride(i));
+    }
+    return offset;
+  }
+
+  static uint64_t file_size(uint64_t capacity) {
+    return array_offset(ARRAY_COUNT, capacity);
+  }
+
+  Status::Code create(uint64_t capacity) {
+    uint64_t size = file_size(capacity);
+    if (ftruncate(fd_, size) != 0) {
+      return Status::IO_ERROR;
+    }
+
+    Status::Code status = map(size);
+    if (status != Status::OK) {
+      return status;
+    }
+
+    header_->magic = MAGIC;
+    header_->version = VERSION;
+    header_->key_size = sizeof(Key);
+    header_->value_size = sizeof(Value);
+    header_->capacity = capacity;
+    header_->size = 0;
+    header_->handle_count = 0;
+    header_->free_count = 0;
+
+    // An empty table has a trivially complete index.
+    indexed_ = true;
+    bind();
+    return Status::OK;
+  }
+
+  Status::Code attach(uint64_t size) {
+    if (size < sizeof(Header)) {
+      return Status::INCOMPATIBLE_DATA_TYPES;
+    }
+
+    Status::Code status = map(size);
+    if (status != Status::OK) {
+      return status;
+    }
+
+    if (header_->magic != MAGIC || header_->version != VERSION ||
+        header_->key_size != sizeof(Key) ||
+        header_->value_size != sizeof(Value) ||
+        file_size(header_->capacity) > size) {
+      return Status::INCOMPATIBLE_DATA_TYPES;
+    }
+
+    bind();
+    return Status::OK;
+  }
+
+  bool sync_directory() const {
+    size_t slash = path_.rfind('/');
+    std::string dir = slash == std::string::npos ? "." :
+        slash == 0 ? "/" : path_.substr(0, slash);
+    int fd = ::open(dir.data(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+      return false;
+    }
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+  }
+
+  Status::Code map(uint64_t size) {
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+      header_ = nullptr;
+      mapped_size_ = 0;
+      return Status::IO_ERROR;
+    }
+    header_ = (Header*)addr;
+    mapped_size_ = size;
+    return Status::OK;
+  }
+
+  // Points the arrays at their place in the current mapping.
+  void bind() {
+    if (!header_) {
+      keys = Keys();
+      values = Values();
+      handles_ = nullptr;
+      rows_ = nullptr;
+      free_handles_ = nullptr;
+      return;
+    }
+
+    uint8_t* base = (uint8_t*)header_;
+    uint64_t capacity = header_->capacity;
+    keys.data_ = (Key*)(base + array_offset(KEYS, capacity));
+    keys.size_ = &header_->size;
+    values.data_ = (Value*)(base + array_offset(VALUES, capacity));
+    values.size_ = &header_->size;
+    handles_ = (Slot*)(base + array_offset(HANDLES, capacity));
+    rows_ = (Handle*)(base + array_offset(ROWS, capacity));
+    free_handles_ = (uint64_t*)(base + array_offset(FREE_HANDLES, capacity));
+  }
+
+  // Takes a free slot, or a new one, for the element at row.
+  Handle make_handle(uint64_t row) {
+    if (header_->free_count) {
+      uint64_t slot = free_handles_[--header_->free_count];
+      handles_[slot].row = row;
+      return pack_handle(slot, handles_[slot].generation);
+    }
+    uint64_t slot = header_->handle_count++;
+    handles_[slot] = Slot{row, 0};
+    return pack_handle(slot, 0);
+  }
+
+  // Bumps the slot's generation so that outstanding handles to it go stale.
+  void release_handle(Handle h) {
+    uint64_t slot = handle_slot(h);
+    handles_[slot].generation =
+        (handles_[slot].generation + 1) & HANDLE_GENERATION_MASK;
+    free_handles_[header_->free_count++] = slot;
+  }
+
+  void build_index() const {
+    index_.clear();
+    for (uint64_t i = 0; i < header_->size; ++i) {
+      index_[keys[i]] = rows_[i];
+    }
+    indexed_ = true;
+  }
+
+  Header* header_ = nullptr;
+  uint64_t mapped_size_ = 0;
+  int fd_ = -1;
+  std::string path_;
+
+  Slot* handles_ = nullptr;
+  Handle* rows_ = nullptr;
+  uint64_t* free_handles_ = nullptr;
+
+  mutable Index index_;
+  mutable bool indexed_ = false;
+};
+
+}  // namespace radiance
+
+#endif  // __COMPILE_AS_LINUX__
+
+#endif  // MAPPED_TABLE__H
@@ -0,0 +1,394 @@
+/**
+* Author: Samuel Rohde (rohde.samuel@gmail.com)
+*
+* This file is subject to the terms and conditions defined in
+* file 'LICENSE.txt', which is part of this source code package.
+*/
+
+#ifndef MUTATION_LOG__H
+#define MUTATION_LOG__H
+
+#include "common.h"
+#include "table.h"
+
+#ifdef __COMPILE_AS_LINUX__
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace radiance
+{
+
+// An append-only log of the mutations applied to a Table. Attach it to a
+// MutationBuffer with set_log() and call end_frame() once per frame. Replaying
+// the log onto the snapshot of a Table taken at frame F reconstructs the
+// Table at any later logged frame.
+//
+// File layout: a Header followed by records. A mutation record is
+//   uint8 mutate_by | uint8 indexed_by | key | value
+// Every mutation is logged by the key of its element. Handles and row
+// offsets are not stable, a snapshot reassigns handles and reorder() moves
+// rows, so updates by handle or offset are resolved to their key when they
+// are appended. Removes have no value. A frame record is
+//   uint8 FRAME | uint64 frame | uint64 bytes of mutations in the frame
+// and closes the frame: mutations after the last frame record are ignored on
+// replay, which also discards writes torn by a crash.
+template<typename Table_>
+class MutationLog {
+public:
+  typedef Table_ Table;
+  typedef typename Table::Key Key;
+  typedef typename Table::Value Value;
+  typedef typename Table::Mutation Mutation;
+
+  static_assert(std::is_trivially_copyable<Key>::value,
+                "MutationLog keys must be trivially copyable.");
+  static_assert(std::is_trivially_copyable<Value>::value,
+                "MutationLog values must be trivially copyable.");
+
+  enum class Sync {
+    // Leave writing back to the OS.
+    NONE = 0,
+    // fsync at the end of every frame.
+    FRAME,
+    // fsync after every commit, i.e. every MutationBuffer flush.
+    COMMIT,
+  };
+
+  static const uint64_t MAGIC = 0x474F4C44434E4452;  // "RDNCDLOG"
+  static const uint32_t VERSION = 2;
+
+  // Writes are batched up to this many bytes between commits.
+  static const uint64_t MAX_BATCH_SIZE = 1 << 20;
+
+  MutationLog() {}
+
+  MutationLog(const MutationLog&) = delete;
+  MutationLog& operator=(const MutationLog&) = delete;
+
+  ~MutationLog() {
+    close();
+  }
+
+  // Opens the log at path for appending, creating it if it does not exist.
+  Status::Code open(const char* path, Sync sync = Sync::FRAME) {
+    close();
+
+    fd_ = ::open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) {
+      return Status::DOES_NOT_EXIST;
+    }
+    sync_ = sync;
+    buffer_.reserve(MAX_BATCH_SIZE + sizeof(Mutation) + FRAME_RECORD_SIZE);
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      close();
+      return Status::IO_ERROR;
+    }
+
+    if (st.st_size == 0) {
+      Header header = make_header();
+      if (!write_all((const uint8_t*)&header, sizeof(Header)) || fsync(fd_) != 0) {
+        close();
+        return Status::IO_ERROR;
+      }
+    } else {
+      // Drop a frame that was cut short by a crash so that new frames
+      // follow the last complete one.
+      uint64_t size = 0;
+      Status::Code status = scan(
+          fd_, [](uint64_t, const uint8_t*, const uint8_t*) { return true; },
+          &size);
+      if (status == Status::OK && size < (uint64_t)st.st_size &&
+          ftruncate(fd_, size) != 0) {
+        status = Status::IO_ERROR;
+      }
+      if (status != Status::OK) {
+        close();
+        return status;
+      }
+    }
+    return Status::OK;
+  }
+
+  Status::Code close() {
+    Status::Code status = Status::OK;
+    if (fd_ >= 0) {
+      status = commit();
+      if (::close(fd_) != 0) {
+        status = Status::IO_ERROR;
+      }
+    }
+    fd_ = -1;
+    buffer_.clear();
+    frame_bytes_ = 0;
+    return status;
+  }
+
+  // Appends m as it is about to be applied to table. Updates of elements
+  // that are not in the table are not logged, since they change nothing.
+  void append(const Table* table, const Mutation& m) {
+    const Key* key = &m.el.key;
+    if (m.mutate_by == MutateBy::UPDATE) {
+      if (m.el.indexed_by == IndexedBy::HANDLE) {
+        if (!table->valid(m.el.handle)) {
+          return;
+        }
+        key = &table->key(table->row(m.el.handle));
+      } else if (m.el.indexed_by == IndexedBy::OFFSET) {
+        if ((uint64_t)m.el.offset >= table->size()) {
+          return;
+        }
+        key = &table->key(m.el.offset);
+      }
+    }
+
+    size_t size = 2 + sizeof(Key) +
+        (m.mutate_by == MutateBy::REMOVE ? 0 : sizeof(Value));
+
+    size_t at = buffer_.size();
+    buffer_.resize(at + size);
+    uint8_t* p = buffer_.data() + at;
+    *p++ = (uint8_t)m.mutate_by;
+    *p++ = (uint8_t)IndexedBy::KEY;
+    memcpy(p, key, sizeof(Key));
+    p += sizeof(Key);
+    if (m.mutate_by != MutateBy::REMOVE) {
+      memcpy(p, &m.el.value, sizeof(Value));
+    }
+
+    frame_bytes_ += size;
+    ++mutation_count_;
+    if (buffer_.size() >= MAX_BATCH_SIZE) {
+      write_buffer();
+    }
+  }
+
+  // Writes out all appended mutations.
+  Status::Code commit() {
+    if (!write_buffer()) {
+      return Status::IO_ERROR;
+    }
+    if (sync_ == Sync::COMMIT && fd_ >= 0 && fsync(fd_) != 0) {
+      return Status::IO_ERROR;
+    }
+    return Status::OK;
+  }
+
+  // Closes the current frame. All mutations appended since the last call
+  // belong to this frame.
+  Status::Code end_frame(uint64_t frame) {
+    size_t at = buffer_.size();
+    buffer_.resize(at + FRAME_RECORD_SIZE);
+    uint8_t* p = buffer_.data() + at;
+    *p++ = FRAME;
+    memcpy(p, &frame, sizeof(uint64_t));
+    memcpy(p + sizeof(uint64_t), &frame_bytes_, sizeof(uint64_t));
+    frame_bytes_ = 0;
+
+    if (!write_buffer()) {
+      return Status::IO_ERROR;
+    }
+    if (sync_ != Sync::NONE && fsync(fd_) != 0) {
+      return Status::IO_ERROR;
+    }
+    return Status::OK;
+  }
+
+  inline uint64_t bytes_written() const {
+    return bytes_written_;
+  }
+
+  inline uint64_t mutation_count() const {
+    return mutation_count_;
+  }
+
+  // Applies every frame f with after_frame < f <= until_frame in the log at
+  // path to table. If last_frame is given it is set to the last frame that
+  // was applied.
+  static Status::Code replay(const char* path, Table* table,
+                             uint64_t after_frame, uint64_t until_frame,
+                             uint64_t* last_frame = nullptr) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return Status::DOES_NOT_EXIST;
+    }
+
+    Status::Code status = scan(
+        fd, [&](uint64_t frame, const uint8_t* begin, const uint8_t* end) {
+          if (frame > until_frame) {
+            return false;
+          }
+          if (frame > after_frame) {
+            for (const uint8_t* r = begin; r < end; r += record_size(r, end)) {
+              MutationBuffer<Table>::resolve(table, decode(r));
+            }
+            if (last_frame) {
+              *last_frame = frame;
+            }
+          }
+          return true;
+        });
+    ::close(fd);
+    return status;
+  }
+
+private:
+  struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t reserved;
+  };
+
+  static const uint8_t FRAME = 0xFF;
+  static const size_t FRAME_RECORD_SIZE = 1 + 2 * sizeof(uint64_t);
+
+  static Header make_header() {
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.key_size = sizeof(Key);
+    header.value_size = sizeof(Value);
+    return header;
+  }
+
+  static const Header& expected_header() {
+    static const Header header = make_header();
+    return header;
+  }
+
+  // Returns the size of the mutation record at p, or 0 if it is cut short
+  // or not by key.
+  static size_t record_size(const uint8_t* p, const uint8_t* end) {
+    if (end - p < 2 || (IndexedBy)p[1] != IndexedBy::KEY) {
+      return 0;
+    }
+    MutateBy mutate_by = (MutateBy)p[0];
+    size_t size = 2 + sizeof(Key) +
+        (mutate_by == MutateBy::REMOVE ? 0 : sizeof(Value));
+    return (size_t)(end - p) < size ? 0 : size;
+  }
+
+  static Mutation decode(const uint8_t* p) {
+    Mutation m;
+    m.mutate_by = (MutateBy)*p++;
+    m.el.indexed_by = (IndexedBy)*p++;
+
+    memcpy(&m.el.key, p, sizeof(Key));
+    p += sizeof(Key);
+    if (m.mutate_by != MutateBy::REMOVE) {
+      memcpy(&m.el.value, p, sizeof(Value));
+    }
+    return m;
+  }
+
+  // Calls f(frame, begin, end) with the mutation records of every complete
+  // frame in the log until f returns false. If size is given it is set to
+  // the end of the last complete frame.
+  template<typename Function_>
+  static Status::Code scan(int fd, Function_ f, uint64_t* size = nullptr) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(Header)) {
+      return Status::INCOMPATIBLE_DATA_TYPES;
+    }
+
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      return Status::IO_ERROR;
+    }
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    const uint8_t* begin = (const uint8_t*)addr;
+    const uint8_t* end = begin + st.st_size;
+    Status::Code status = Status::OK;
+    if (memcmp(begin, &expected_header(), sizeof(Header)) != 0) {
+      status = Status::INCOMPATIBLE_DATA_TYPES;
+    }
+
+    // A frame's records precede its frame record, so find each frame's
+    // extent first and only hand it out once it is known to be complete.
+    const uint8_t* p = begin + sizeof(Header);
+    const uint8_t* frame_begin = p;
+    while (status == Status::OK && p < end) {
+      if (*p != FRAME) {
+        size_t record = record_size(p, end);
+        if (record == 0) {
+          break;
+        }
+        p += record;
+        continue;
+      }
+
+      if ((size_t)(end - p) < FRAME_RECORD_SIZE) {
+        break;
+      }
+      uint64_t frame, frame_bytes;
+      memcpy(&frame, p + 1, sizeof(uint64_t));
+      memcpy(&frame_bytes, p + 1 + sizeof(uint64_t), sizeof(uint64_t));
+      if (frame_bytes != (uint64_t)(p - frame_begin)) {
+        status = Status::INCOMPATIBLE_DATA_TYPES;
+        break;
+      }
+
+      if (!f(frame, frame_begin, p)) {
+        break;
+      }
+      p += FRAME_RECORD_SIZE;
+      frame_begin = p;
+    }
+
+    if (size) {
+      *size = frame_begin - begin;
+    }
+    munmap(addr, st.st_size);
+    return status;
+  }
+
+  bool write_all(const uint8_t* data, size_t size) {
+    while (size > 0) {
+      ssize_t written = write(fd_, data, size);
+      if (written < 0) {
+        return false;
+      }
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  bool write_buffer() {
+    if (buffer_.empty() || fd_ < 0) {
+      return true;
+    }
+    bool ok = write_all(buffer_.data(), buffer_.size());
+    bytes_written_ += buffer_.size();
+    buffer_.clear();
+    return ok;
+  }
+
+  int fd_ = -1;
+  Sync sync_ = Sync::FRAME;
+  std::vector<uint8_t> buffer_;
+
+  // Bytes of mutation records since the last frame record.
+  uint64_t frame_bytes_ = 0;
+
+  uint64_t bytes_written_ = 0;
+  uint64_t mutation_count_ = 0;
+};
+
+}  // namespace radiance
+
+#endif  // __COMPILE_AS_LINUX__
+
+#endif  // MUTATION_LOG__H
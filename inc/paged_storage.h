@@ -0,0 +1,187 @@
+/**
+* Author: Samuel Rohde (rohde.samuel@gmail.com)
+*
+* This file is subject to the terms and conditions defined in
+* file 'LICENSE.txt', which is part of this source code package.
+*/
+
+#ifndef PAGED_STORAGE__H
+#define PAGED_STORAGE__H
+
+#include "common.h"
+#include "radiance.h"
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace radiance
+{
+
+constexpr uint64_t floor_log2(uint64_t x) {
+  return x <= 1 ? 0 : 1 + floor_log2(x / 2);
+}
+
+// An array stored in fixed size chunks. Growing it allocates at most one
+// chunk and never moves elements, so their addresses stay valid until they
+// are removed. Supports the subset of std::vector that Table uses.
+template<typename T, size_t ChunkBytes_ = 16384>
+class PagedArray {
+public:
+  typedef T value_type;
+
+  // Elements per chunk, rounded down to a power of two so that finding an
+  // element's chunk is a shift.
+  static const uint64_t CHUNK_SHIFT = floor_log2(ChunkBytes_ / sizeof(T));
+  static const uint64_t CHUNK_SIZE = 1ull << CHUNK_SHIFT;
+  static const uint64_t CHUNK_MASK = CHUNK_SIZE - 1;
+
+  PagedArray() {}
+
+  PagedArray(const PagedArray&) = delete;
+  PagedArray& operator=(const PagedArray&) = delete;
+
+  ~PagedArray() {
+    clear();
+    shrink_to_fit();
+  }
+
+  inline T& operator[](uint64_t i) {
+    return chunks_[i >> CHUNK_SHIFT][i & CHUNK_MASK];
+  }
+
+  inline const T& operator[](uint64_t i) const {
+    return chunks_[i >> CHUNK_SHIFT][i & CHUNK_MASK];
+  }
+
+  inline T& back() {
+    return (*this)[size_ - 1];
+  }
+
+  inline const T& back() const {
+    return (*this)[size_ - 1];
+  }
+
+  void push_back(const T& t) {
+    new (grow()) T(t);
+  }
+
+  void push_back(T&& t) {
+    new (grow()) T(std::move(t));
+  }
+
+  void pop_back() {
+    back().~T();
+    --size_;
+  }
+
+  template<typename Iterator_>
+  void assign(Iterator_ begin, Iterator_ end) {
+    clear();
+    for (; begin != end; ++begin) {
+      push_back(*begin);
+    }
+  }
+
+  void clear() {
+    while (size_ > 0) {
+      pop_back();
+    }
+  }
+
+  // Allocates the chunks for count elements up front.
+  void reserve(uint64_t count) {
+    uint64_t chunks = (count + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    chunks_.reserve(chunks);
+    while (chunks_.size() < chunks) {
+      chunks_.push_back(allocate());
+    }
+  }
+
+  // Frees the chunks past the last element.
+  void shrink_to_fit() {
+    uint64_t used = (size_ + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    while (chunks_.size() > used) {
+      allocator_.deallocate(chunks_.back(), CHUNK_SIZE);
+      chunks_.pop_back();
+    }
+  }
+
+  inline uint64_t size() const {
+    return size_;
+  }
+
+  inline bool empty() const {
+    return size_ == 0;
+  }
+
+  inline uint64_t capacity() const {
+    return chunks_.size() * CHUNK_SIZE;
+  }
+
+  inline uint64_t chunk_count() const {
+    return (size_ + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+  }
+
+  inline T* chunk(uint64_t i) {
+    return chunks_[i];
+  }
+
+  inline const T* chunk(uint64_t i) const {
+    return chunks_[i];
+  }
+
+private:
+  T* allocate() {
+    return allocator_.allocate(CHUNK_SIZE);
+  }
+
+  T* grow() {
+    if (size_ == capacity()) {
+      chunks_.push_back(allocate());
+    }
+    return &(*this)[size_++];
+  }
+
+  std::allocator<T> allocator_;
+  std::vector<T*> chunks_;
+  uint64_t size_ = 0;
+};
+
+// Table storage policies. A Table keeps its keys and values in
+// Storage::Array<Key> and Storage::Array<Value>.
+template<size_t ChunkBytes_ = 16384>
+struct PagedStorage {
+  template<typename T>
+  using Array = PagedArray<T, ChunkBytes_>;
+};
+
+// Collection::span hook for a Table with PagedStorage. A span ends where
+// either the key chunk or the value chunk ends.
+template<typename Table_>
+void paged_span(Collection* c, uint64_t row, Span* span) {
+  typedef typename Table_::Keys Keys;
+  typedef typename Table_::Values Values;
+  Table_* table = (Table_*)c->collection;
+
+  uint64_t key_chunk = row >> Keys::CHUNK_SHIFT;
+  uint64_t value_chunk = row >> Values::CHUNK_SHIFT;
+  uint64_t first = std::max(key_chunk << Keys::CHUNK_SHIFT,
+                            value_chunk << Values::CHUNK_SHIFT);
+  uint64_t end = std::min((key_chunk + 1) << Keys::CHUNK_SHIFT,
+                          (value_chunk + 1) << Values::CHUNK_SHIFT);
+  end = std::min(end, table->size());
+
+  span->first = first;
+  span->count = end - first;
+  span->keys = (uint8_t*)(table->keys.chunk(key_chunk) +
+                          (first & Keys::CHUNK_MASK));
+  span->values = (uint8_t*)(table->values.chunk(value_chunk) +
+                            (first & Values::CHUNK_MASK));
+}
+
+}  // namespace radiance
+
+#endif  // PAGED_STORAGE__H
@@ -45,13 +45,43 @@ struct Mutation {
   uint8_t* element;
 };
 
-typedef bool (*Select)(uint8_t, ...);
+// A subset of the rows of a collection, in ascending order.
+struct Selection {
+  uint64_t count;
+  const uint64_t* rows;
+};
+
+// Sets selected[i] to nonzero for each of count consecutive values of the
+// source, starting at values, that should be transformed. Written as a plain
+// loop over the values this vectorizes well.
+typedef void (*Select)(const uint8_t* values, uint64_t count, uint8_t* selected);
+typedef void (*SelectRows)(struct Pipeline*, struct Collection* source, struct Selection*);
 typedef void (*Transform)(struct Stack*);
 typedef void (*Callback)(struct Pipeline*, ...);
+typedef void (*Accumulate)(struct Stack*, uint8_t* partial);
+typedef void (*Combine)(uint8_t* partial, const uint8_t* other);
 
 typedef void (*Mutate)(struct Collection*, const struct Mutation*);
 typedef void (*Copy)(const uint8_t* key, const uint8_t* value, uint64_t index, struct Stack*);
 typedef uint64_t (*Count)(struct Collection*);
+typedef void (*Reorder)(struct Collection*, uint64_t budget_ns);
+typedef void (*Prepare)(struct Collection*);
+typedef void (*Load)(struct Collection*, const uint8_t* keys, const uint8_t* values, uint64_t count);
+typedef void (*Bind)(struct Collection*);
+typedef void (*Shrink)(struct Collection*);
+typedef uint64_t (*Merge)(struct Collection*);
+typedef uint64_t (*Publish)(struct Collection*);
+
+// Consecutive rows of a collection whose keys and values are each stored
+// contiguously.
+struct Span {
+  uint64_t first;
+  uint64_t count;
+  uint8_t* keys;
+  uint8_t* values;
+};
+
+typedef void (*SpanOf)(struct Collection*, uint64_t row, struct Span*);
 
 struct Iterator {
   uint8_t* data;
@@ -72,6 +102,45 @@ struct Collection {
   Copy copy;
   Mutate mutate;
   Count count;
+
+  // Optional. Called between frames to incrementally restore the iteration
+  // order of the collection within the given time budget.
+  Reorder reorder;
+
+  // Optional. Replaces the contents of the collection with count raw keys and
+  // values, e.g. when loading a snapshot. The pointers are only valid for the
+  // duration of the call.
+  Load load;
+
+  // Optional. Called at the start of every loop() before any pipeline runs,
+  // e.g. to rebuild a SpatialIndex over the collection.
+  Prepare prepare;
+
+  // Optional. For collections that are not stored in one array, e.g. a Table
+  // with PagedStorage. Fills in the span that holds row. If set, keys.data
+  // and values.data are not used and pipelines are run one span at a time.
+  SpanOf span;
+
+  // Optional. Points keys.data and values.data at the collection's current
+  // storage. Called before every pipeline run over the collection, so the
+  // storage may move between runs, e.g. when a Table grows.
+  Bind bind;
+
+  // Optional. Releases unused capacity. Only called between frames, after
+  // shrink_collection() is used to ask for it.
+  Shrink shrink;
+
+  // Optional. Called at the start of every loop(), before prepare, to apply
+  // the mutations other threads have streamed into ingest, e.g. an Ingest.
+  // Returns the number applied.
+  Merge merge;
+  void* ingest;
+
+  // Optional. Called at the end of every loop(), after the pipelines and
+  // jobs, to hand the frame's changes to the consumers of feed, e.g. a
+  // ChangeFeed. Returns the number of changes published.
+  Publish publish;
+  void* feed;
 };
 
 struct Collections {
@@ -93,13 +162,71 @@ struct ExecutionPolicy {
   Trigger trigger;
 };
 
+// Folds the rows of a pipeline's source into one value, e.g. a bounding box,
+// an energy sum, or a count. Every worker folds its rows into a partial of
+// its own, and the partials are combined pairwise in a tree. The result is
+// written as the only row of the pipeline's sink, with a zeroed key, through
+// the sink's Load hook, e.g. load_table.
+struct Reduction {
+  // Bytes of a partial, and of the sink's value.
+  uint64_t size;
+
+  // The partial every worker starts from, e.g. zero for a sum.
+  const uint8_t* identity;
+
+  // Folds the row copied onto the stack by the source's Copy hook into
+  // partial.
+  Accumulate accumulate;
+
+  // Folds other into partial. Must be associative and commutative.
+  Combine combine;
+};
+
 struct Pipeline {
   const Id id;
   const Id program;
   const void* self;
 
+  // Optional. Filters the rows of the source in batches before they are
+  // transformed.
   Select select;
   Transform transform;
+
+  // Optional. Restricts the pipeline to a subset of the rows of its source,
+  // e.g. from a HashIndex or SortedIndex on the source's Table. The selection
+  // is initialized to every row and must stay valid until the pipeline has
+  // run.
+  SelectRows select_rows;
+
+  // Optional. If reduce.accumulate is set, the rows of the source are reduced
+  // into the sink instead of being mutated one by one. The transform, if
+  // set, is run on each row before it is accumulated.
+  Reduction reduce;
+
+  // Optional. If set, the rows of the source that pass the select_rows and
+  // select hooks replace the contents of the sink, e.g. to gather the live
+  // particles into a collection of their own, or into the source itself to
+  // drop the dead ones. Rows are copied as raw keys and values in row order,
+  // without a transform, through the sink's Load hook, so the sink's keys and
+  // values must be the same size as the source's; enable_pipeline returns
+  // INCOMPATIBLE_DATA_TYPES if they are not. With load_table, the kept
+  // elements keep their handles and the handles of the dropped ones go stale,
+  // as if they were removed.
+  bool compact;
+};
+
+enum class ExecutionMode {
+  UNKNOWN = 0,
+  // Mutations are applied as soon as each element is transformed.
+  FAST,
+  // Mutations are staged per thread and applied in element order after all
+  // elements are transformed, so results do not depend on thread timing.
+  DETERMINISTIC,
+};
+
+enum class Compression {
+  NONE = 0,
+  LZ,
 };
 
 struct Program {
@@ -108,11 +235,64 @@ struct Program {
   const void* self;
 };
 
+typedef bool (*Resume)(struct Job*, uint64_t budget_ns);
+typedef void (*Release)(struct Job*);
+
+// Work that takes longer than a frame, run a slice at a time. Every loop()
+// resumes each job once after the pipelines have run, on the thread calling
+// loop(). See task.h for jobs written as coroutines.
+struct Job {
+  const Id id;
+
+  // Runs the next slice of the job, for about budget_ns. Returns true when
+  // the job is done, after which it is released and removed.
+  Resume resume;
+
+  // Optional. Frees the state once the job is done or removed.
+  Release release;
+
+  void* state;
+
+  // The time the job may take each frame. Zero is no limit.
+  uint64_t budget_ns;
+};
+
+// Sets up a new universe and its executor from universe->executor.
 Status::Code init(Universe* universe);
 Status::Code start();
 Status::Code stop();
 Status::Code loop();
 
+// Counts the frames started by loop_async(), from 1.
+typedef uint64_t Fence;
+
+// Starts the next loop() on a background thread and returns without waiting
+// for it. Waits for the frame before to finish first, so at most one frame
+// runs at a time. Until the frame is waited on, only loop_async(),
+// wait_frame() and read_view() may be called. Returns 0 if the frame before
+// failed.
+Fence loop_async();
+
+// Waits for the frame to finish and returns what its loop() returned. Read
+// views are only updated when fence is the last frame started, waiting on an
+// older one leaves them as they are.
+Status::Code wait_frame(Fence fence);
+
+// The rows of a watched collection as of the last finished frame, packed
+// keys.size and values.size bytes apart. Stays unchanged while the next
+// frame runs, until the next loop_async() or wait_frame() on the last frame.
+struct ReadView {
+  uint64_t frame;
+  uint64_t count;
+  const uint8_t* keys;
+  const uint8_t* values;
+};
+
+// Copies the collection at the end of every frame run by loop_async() into
+// a double-buffered ReadView.
+Status::Code watch_collection(Collection* collection);
+Status::Code read_view(Collection* collection, ReadView* view);
+
 Id create_program(const char* name);
 
 struct Pipeline* add_pipeline(const char* program, const char* source, const char* sink);
@@ -121,6 +301,11 @@ Status::Code remove_pipeline(struct Pipeline* pipeline);
 Status::Code enable_pipeline(struct Pipeline* pipeline, ExecutionPolicy policy);
 Status::Code disable_pipeline(struct Pipeline* pipeline);
 
+// Jobs may add jobs, which are first resumed in the next frame, but not
+// remove them.
+struct Job* add_job();
+Status::Code remove_job(struct Job* job);
+
 Collection* add_collection(const char* program, const char* name);
 
 Status::Code add_source(struct Pipeline*, const char* collection);
@@ -129,6 +314,108 @@ Status::Code add_sink(struct Pipeline*, const char* collection);
 Status::Code share_collection(const char* source, const char* dest);
 Status::Code copy_collection(const char* source, const char* dest);
 
+// Sets the time per loop() that is spent reordering collections. A budget of
+// zero disables reordering.
+Status::Code set_reorder_budget(uint64_t budget_ns);
+
+Status::Code set_execution_mode(ExecutionMode mode);
+
+// Limits the time per loop() spent on pipelines. Pipelines run from the
+// highest priority down. Those with at least critical_priority always run all
+// of their rows. The rest are skipped once the budget is used up, or stop
+// part way through their rows and carry on from there in the next frame. A
+// budget of zero runs every pipeline in full.
+Status::Code set_frame_budget(uint64_t budget_ns, int16_t critical_priority);
+
+// Counts since init() of how the frame budget was kept, and of the mutations
+// streamed in from other threads.
+struct FrameStats {
+  uint64_t frames;
+
+  // Frames that took longer than the budget, e.g. for critical pipelines.
+  uint64_t over_budget;
+
+  // Times a pipeline did not run because the budget was used up.
+  uint64_t skipped;
+
+  // Times a pipeline stopped part way through its rows.
+  uint64_t deferred;
+
+  uint64_t last_frame_ns;
+
+  // Mutations applied by the collections' merge hooks.
+  uint64_t ingested;
+
+  // Changes handed out by the collections' publish hooks.
+  uint64_t published;
+};
+
+FrameStats frame_stats();
+
+// Memory used by the per thread stacks that pipelines transform elements on.
+// Stacks grow as needed and are reset between frames.
+struct ScratchStats {
+  uint64_t threads;
+
+  // Bytes reserved by all stacks.
+  uint64_t capacity;
+
+  // Most bytes any one stack held at once, ever and in the last frame.
+  uint64_t high_water;
+  uint64_t frame_high_water;
+
+  uint64_t chunk_allocations;
+};
+
+ScratchStats scratch_stats();
+
+// The NUMA nodes that pipelines split their rows over. Each node's threads run
+// one contiguous range of rows, and the rows are moved to the node's memory.
+// Pin the OpenMP threads (e.g. OMP_PROC_BIND=spread, or ExecutorConfig::cpus)
+// so that they stay on their node. Returns 1 without NUMA.
+uint64_t numa_nodes();
+
+// What a worker did in the pipeline runs since init(). A worker is busy from
+// the start of a run until it runs out of rows, and idle from then until the
+// last worker is done. Its utilization is busy_ns / (busy_ns + idle_ns).
+struct WorkerStats {
+  uint64_t runs;
+  uint64_t busy_ns;
+  uint64_t idle_ns;
+
+  // The CPU the worker last started a run on, and how many runs started on
+  // a different CPU than the one before.
+  int64_t cpu;
+  uint64_t migrations;
+};
+
+uint64_t worker_count();
+Status::Code worker_stats(uint64_t worker, WorkerStats* stats);
+
+// Shrinks the collection with its Shrink hook at the end of the next loop(),
+// when no pipeline is running over it.
+Status::Code shrink_collection(Collection* collection);
+
+// Hashes the keys and values of every collection.
+uint64_t hash_collections();
+
+// Runs the pipelines of a loop() twice from the same starting state and
+// compares the hashes of all collections after each run. Returns
+// NONDETERMINISTIC if they differ. Ingested mutations are merged and jobs
+// run once, so the universe is left as after a single loop(). Every
+// collection with a Count hook needs a Load hook.
+Status::Code verify_loop();
+
+// Writes the programs and the contents of all collections to path. Key and
+// value arrays are written as raw bytes, so they must be trivially copyable.
+Status::Code save_snapshot(const char* path, Compression compression);
+
+// Creates the programs in the snapshot and loads the contents of every
+// collection in it. The collections must already be added and have a Load
+// hook. Pipelines are not part of a snapshot. Nothing is loaded if any part
+// of the snapshot is missing or corrupt.
+Status::Code load_snapshot(const char* path);
+
 #ifdef __cplusplus
 }  // namespace radiance
 #endif
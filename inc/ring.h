@@ -0,0 +1,118 @@
+#ifndef RING__H
+#define RING__H
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "common.h"
+
+namespace radiance
+{
+
+// A bounded lock-free queue between one producer thread and one consumer
+// thread. Records are built in place in the ring and read in place by the
+// consumer, so a record is never copied on the way through. The producer
+// may claim several slots and publish them at once.
+template<typename T>
+class SpscRing {
+public:
+  // The capacity is rounded up to a power of two.
+  explicit SpscRing(uint64_t capacity) {
+    capacity_ = 1;
+    while (capacity_ < capacity) {
+      capacity_ <<= 1;
+    }
+    mask_ = capacity_ - 1;
+    slots_.reset(new Slot[capacity_]);
+  }
+
+  ~SpscRing() {
+    consume_all([](T&) {});
+  }
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  // Producer. Returns uninitialized memory for the next record, to be
+  // constructed with placement new, or nullptr if the ring is full.
+  T* claim() {
+    if (claimed_ - cached_head_ == capacity_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (claimed_ - cached_head_ == capacity_) {
+        return nullptr;
+      }
+    }
+    return (T*)&slots_[claimed_++ & mask_];
+  }
+
+  // Producer. Hands every claimed record to the consumer.
+  void publish() {
+    tail_.store(claimed_, std::memory_order_release);
+  }
+
+  template<typename... Args_>
+  bool emplace(Args_&&... args) {
+    T* slot = claim();
+    if (!slot) {
+      return false;
+    }
+    new (slot) T(std::forward<Args_>(args)...);
+    publish();
+    return true;
+  }
+
+  // Consumer. Calls f(T&) on every published record, oldest first, and
+  // frees their slots. Returns the number of records.
+  template<typename Function_>
+  uint64_t consume_all(Function_ f) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    for (uint64_t i = head; i < tail; ++i) {
+      T* record = (T*)&slots_[i & mask_];
+      f(*record);
+      if (!std::is_trivially_destructible<T>::value) {
+        record->~T();
+      }
+    }
+    head_.store(tail, std::memory_order_release);
+    return tail - head;
+  }
+
+  // Records published but not yet consumed. Only a hint while the producer
+  // is running.
+  uint64_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  uint64_t capacity() const {
+    return capacity_;
+  }
+
+private:
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+  // The producer's and consumer's counters are a cache line apart so that
+  // they do not share one.
+  uint64_t capacity_;
+  uint64_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  uint8_t padding0_[CACHE_LINE_SIZE];
+
+  // Written by the consumer.
+  std::atomic<uint64_t> head_{0};
+  uint8_t padding1_[CACHE_LINE_SIZE];
+
+  // Written by the producer.
+  std::atomic<uint64_t> tail_{0};
+  uint64_t claimed_ = 0;
+  uint64_t cached_head_ = 0;
+  uint8_t padding2_[CACHE_LINE_SIZE];
+};
+
+}  // namespace radiance
+
+#endif  // RING__H
@@ -10,6 +10,9 @@
 
 #include "common.h"
 #include "table.h"
+#include "mapped_table.h"
+#include "mutation_log.h"
+#include "paged_storage.h"
 
 namespace radiance
 {
@@ -20,11 +23,38 @@ struct Schema {
   typedef radiance::Table<Key_, Value_, Allocator_> Table;
   typedef radiance::View<Table> View;
   typedef typename Table::Element Element;
+  typedef typename Table::Mutation Mutation;
   typedef radiance::MutationBuffer<Table> MutationBuffer;
+#ifdef __COMPILE_AS_LINUX__
+  typedef radiance::MutationLog<Table> MutationLog;
+#endif  // __COMPILE_AS_LINUX__
   typedef Key_ Key;
   typedef Value_ Value;
 };
 
+template<typename Key_, typename Value_, size_t ChunkBytes_ = 16384>
+struct PagedSchema {
+  typedef radiance::Table<Key_, Value_, std::allocator<Value_>,
+                          radiance::PagedStorage<ChunkBytes_>> Table;
+  typedef radiance::View<Table> View;
+  typedef typename Table::Element Element;
+  typedef typename Table::Mutation Mutation;
+  typedef radiance::MutationBuffer<Table> MutationBuffer;
+  typedef Key_ Key;
+  typedef Value_ Value;
+};
+
+#ifdef __COMPILE_AS_LINUX__
+template<typename Key_, typename Value_>
+struct MappedSchema {
+  typedef radiance::MappedTable<Key_, Value_> Table;
+  typedef radiance::View<Table> View;
+  typedef typename Table::Element Element;
+  typedef Key_ Key;
+  typedef Value_ Value;
+};
+#endif  // __COMPILE_AS_LINUX__
+
 }  // namespace radiance
 
 #endif
@@ -0,0 +1,223 @@
+/**
+* Author: Samuel Rohde (rohde.samuel@gmail.com)
+*
+* This file is subject to the terms and conditions defined in
+* file 'LICENSE.txt', which is part of this source code package.
+*/
+
+#ifndef SECONDARY_INDEX__H
+#define SECONDARY_INDEX__H
+
+#include "common.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace radiance
+{
+
+// Secondary indexes map a projection of a Table's values, e.g. a team or a
+// state, to the handles of the elements with that projection. They attach
+// themselves to the Table on construction and are kept up to date by its
+// insert, remove, update, and assign, and so by MutationBuffer::flush. Values
+// written directly through Table::values or operator[] bypass the indexes.
+//
+// Lookups write the matching rows in ascending order, ready to be handed to a
+// pipeline through its select_rows hook.
+
+// Equality lookups in O(1).
+template<typename Table_, typename Field_, typename Hash_ = std::hash<Field_>>
+class HashIndex {
+public:
+  typedef Table_ Table;
+  typedef Field_ Field;
+  typedef typename Table::Value Value;
+  typedef Field (*Projection)(const Value&);
+
+  HashIndex(Table* table, Projection projection) :
+      table_(table), projection_(projection) {
+    table_->add_index(this);
+  }
+
+  HashIndex(const HashIndex&) = delete;
+  HashIndex& operator=(const HashIndex&) = delete;
+
+  ~HashIndex() {
+    table_->remove_index(this);
+  }
+
+  // Appends the rows whose value projects to field. Returns the number of
+  // rows appended.
+  uint64_t select(const Field& field, std::vector<uint64_t>* rows) const {
+    typename Buckets::const_iterator it = buckets_.find(field);
+    if (it == buckets_.end()) {
+      return 0;
+    }
+    uint64_t begin = rows->size();
+    for (Handle h : it->second) {
+      rows->push_back(table_->row(h));
+    }
+    std::sort(rows->begin() + begin, rows->end());
+    return rows->size() - begin;
+  }
+
+  uint64_t count(const Field& field) const {
+    typename Buckets::const_iterator it = buckets_.find(field);
+    return it == buckets_.end() ? 0 : it->second.size();
+  }
+
+  // Called by the Table.
+  void insert(Handle handle, const Value& value) {
+    std::vector<Handle>& bucket = buckets_[projection_(value)];
+    uint64_t slot = handle_slot(handle);
+    if (positions_.size() <= slot) {
+      positions_.resize(slot + 1);
+    }
+    positions_[slot] = bucket.size();
+    bucket.push_back(handle);
+  }
+
+  // Called by the Table.
+  void remove(Handle handle, const Value& value) {
+    typename Buckets::iterator it = buckets_.find(projection_(value));
+    DEBUG_ASSERT(it != buckets_.end(), Status::Code::DOES_NOT_EXIST);
+
+    std::vector<Handle>& bucket = it->second;
+    Handle moved = bucket.back();
+    uint64_t position = positions_[handle_slot(handle)];
+    bucket[position] = moved;
+    positions_[handle_slot(moved)] = position;
+    bucket.pop_back();
+    if (bucket.empty()) {
+      buckets_.erase(it);
+    }
+  }
+
+  // Called by the Table. Most updates leave the projection unchanged.
+  void update(Handle handle, const Value& old_value, const Value& new_value) {
+    if (projection_(old_value) == projection_(new_value)) {
+      return;
+    }
+    remove(handle, old_value);
+    insert(handle, new_value);
+  }
+
+  // Called by the Table.
+  void clear() {
+    buckets_.clear();
+    positions_.clear();
+  }
+
+private:
+  typedef std::unordered_map<Field, std::vector<Handle>, Hash_> Buckets;
+
+  Table* table_;
+  Projection projection_;
+  Buckets buckets_;
+
+  // Position of each handle's slot in its bucket, for O(1) removal.
+  std::vector<uint64_t> positions_;
+};
+
+// Equality and range lookups in O(log n).
+template<typename Table_, typename Field_, typename Compare_ = std::less<Field_>>
+class SortedIndex {
+public:
+  typedef Table_ Table;
+  typedef Field_ Field;
+  typedef typename Table::Value Value;
+  typedef Field (*Projection)(const Value&);
+
+  SortedIndex(Table* table, Projection projection) :
+      table_(table), projection_(projection) {
+    table_->add_index(this);
+  }
+
+  SortedIndex(const SortedIndex&) = delete;
+  SortedIndex& operator=(const SortedIndex&) = delete;
+
+  ~SortedIndex() {
+    table_->remove_index(this);
+  }
+
+  uint64_t select(const Field& field, std::vector<uint64_t>* rows) const {
+    auto range = entries_.equal_range(field);
+    return append_rows(range.first, range.second, rows);
+  }
+
+  // Appends the rows whose value projects into [lo, hi]. Returns the number
+  // of rows appended.
+  uint64_t select(const Field& lo, const Field& hi,
+                  std::vector<uint64_t>* rows) const {
+    return append_rows(entries_.lower_bound(lo), entries_.upper_bound(hi),
+                       rows);
+  }
+
+  uint64_t count(const Field& field) const {
+    return entries_.count(field);
+  }
+
+  uint64_t count(const Field& lo, const Field& hi) const {
+    return std::distance(entries_.lower_bound(lo), entries_.upper_bound(hi));
+  }
+
+  // Called by the Table.
+  void insert(Handle handle, const Value& value) {
+    uint64_t slot = handle_slot(handle);
+    if (positions_.size() <= slot) {
+      positions_.resize(slot + 1);
+    }
+    positions_[slot] = entries_.emplace(projection_(value), handle);
+  }
+
+  // Called by the Table.
+  void remove(Handle handle, const Value&) {
+    entries_.erase(positions_[handle_slot(handle)]);
+  }
+
+  // Called by the Table. Most updates leave the projection unchanged.
+  void update(Handle handle, const Value& old_value, const Value& new_value) {
+    Field old_field = projection_(old_value);
+    Field new_field = projection_(new_value);
+    if (!compare_(old_field, new_field) && !compare_(new_field, old_field)) {
+      return;
+    }
+    entries_.erase(positions_[handle_slot(handle)]);
+    positions_[handle_slot(handle)] = entries_.emplace(new_field, handle);
+  }
+
+  // Called by the Table.
+  void clear() {
+    entries_.clear();
+    positions_.clear();
+  }
+
+private:
+  typedef std::multimap<Field, Handle, Compare_> Entries;
+
+  uint64_t append_rows(typename Entries::const_iterator begin,
+                       typename Entries::const_iterator end,
+                       std::vector<uint64_t>* rows) const {
+    uint64_t first = rows->size();
+    for (; begin != end; ++begin) {
+      rows->push_back(table_->row(begin->second));
+    }
+    std::sort(rows->begin() + first, rows->end());
+    return rows->size() - first;
+  }
+
+  Table* table_;
+  Projection projection_;
+  Compare_ compare_;
+  Entries entries_;
+
+  // Entry of each handle's slot, for O(log n) removal.
+  std::vector<typename Entries::iterator> positions_;
+};
+
+}  // namespace radiance
+
+#endif  // SECONDARY_INDEX__H
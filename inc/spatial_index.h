@@ -0,0 +1,209 @@
+/**
+* Author: Samuel Rohde (rohde.samuel@gmail.com)
+*
+* This file is subject to the terms and conditions defined in
+* file 'LICENSE.txt', which is part of this source code package.
+*/
+
+#ifndef SPATIAL_INDEX__H
+#define SPATIAL_INDEX__H
+
+#include "common.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace radiance
+{
+
+// A uniform grid over the positions of a Table's values for neighbor
+// queries. Cells are hashed into buckets, so the grid is unbounded. The index
+// is a snapshot: rebuild() it once per frame, e.g. from a Collection's
+// prepare hook, before any pipeline queries it. query() is safe to call from
+// many threads at once.
+//
+// Rows are stored as 32-bit offsets, so the Table can hold at most 2^32
+// elements.
+template<typename Table_>
+class SpatialIndex {
+public:
+  typedef Table_ Table;
+  typedef typename Table::Value Value;
+
+  struct Point {
+    float x;
+    float y;
+    float z;
+  };
+
+  typedef Point (*Position)(const Value&);
+
+  SpatialIndex(const Table* table, Position position, float cell_size) :
+      table_(table), position_(position),
+      cell_size_(cell_size), inv_cell_size_(1.0f / cell_size) {}
+
+  // Rebuilds the index with a parallel, stable counting sort of the rows by
+  // bucket. Each thread counts the buckets of a contiguous range of rows,
+  // and a prefix sum over the counts, by bucket and then by thread, gives
+  // every thread its own place in each bucket. Rows within a bucket thus end
+  // up in row order, so that queries visit neighbors in the same order on
+  // every run.
+  void rebuild() {
+    uint64_t n = table_->size();
+    uint64_t bucket_count = MIN_BUCKETS;
+    while (bucket_count < n) {
+      bucket_count *= 2;
+    }
+    bucket_mask_ = bucket_count - 1;
+
+    buckets_.resize(n);
+    points_.resize(n);
+    rows_.resize(n);
+    starts_.resize(bucket_count + 1);
+    starts_[0] = 0;
+
+    int team = std::min<int>(omp_get_max_threads(), MAX_REBUILD_THREADS);
+#pragma omp parallel num_threads(team)
+    {
+      uint64_t threads = omp_get_num_threads();
+      uint64_t thread = omp_get_thread_num();
+#pragma omp single
+      counts_.assign(threads * bucket_count, 0);
+
+      uint32_t* counts = counts_.data() + thread * bucket_count;
+      uint64_t first = n * thread / threads;
+      uint64_t last = n * (thread + 1) / threads;
+      for (uint64_t i = first; i < last; ++i) {
+        Point p = position_(table_->value(i));
+        uint32_t b = bucket(cell(p.x), cell(p.y), cell(p.z));
+        buckets_[i] = b;
+        ++counts[b];
+      }
+#pragma omp barrier
+
+      // Each thread's count becomes where its rows start within the bucket.
+#pragma omp for schedule(static)
+      for (uint64_t b = 0; b < bucket_count; ++b) {
+        uint32_t sum = 0;
+        for (uint64_t t = 0; t < threads; ++t) {
+          uint32_t count = counts_[t * bucket_count + b];
+          counts_[t * bucket_count + b] = sum;
+          sum += count;
+        }
+        starts_[b + 1] = sum;
+      }
+
+#pragma omp single
+      for (uint64_t b = 0; b < bucket_count; ++b) {
+        starts_[b + 1] += starts_[b];
+      }
+
+      for (uint64_t i = first; i < last; ++i) {
+        uint32_t b = buckets_[i];
+        uint32_t slot = starts_[b] + counts[b]++;
+        rows_[slot] = (uint32_t)i;
+        points_[slot] = position_(table_->value(i));
+      }
+    }
+  }
+
+  // Calls f(row, point) for every row whose position is within radius of p.
+  template<typename Function_>
+  void query(const Point& p, float radius, Function_ f) const {
+    if (rows_.empty()) {
+      return;
+    }
+
+    int64_t lo[3] = {cell(p.x - radius), cell(p.y - radius), cell(p.z - radius)};
+    int64_t hi[3] = {cell(p.x + radius), cell(p.y + radius), cell(p.z + radius)};
+    uint64_t cells = (hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1);
+
+    // Different cells can hash to the same bucket; each bucket must only be
+    // visited once.
+    uint32_t small[MAX_SMALL_QUERY];
+    std::vector<uint32_t> large;
+    uint32_t* visited = small;
+    uint64_t count = 0;
+    if (cells > MAX_SMALL_QUERY) {
+      large.resize(cells);
+      visited = large.data();
+    }
+
+    for (int64_t x = lo[0]; x <= hi[0]; ++x) {
+      for (int64_t y = lo[1]; y <= hi[1]; ++y) {
+        for (int64_t z = lo[2]; z <= hi[2]; ++z) {
+          visited[count++] = bucket(x, y, z);
+        }
+      }
+    }
+    std::sort(visited, visited + count);
+    count = std::unique(visited, visited + count) - visited;
+
+    float r2 = radius * radius;
+    for (uint64_t i = 0; i < count; ++i) {
+      uint32_t b = visited[i];
+      for (uint32_t j = starts_[b]; j < starts_[b + 1]; ++j) {
+        const Point& q = points_[j];
+        float dx = q.x - p.x;
+        float dy = q.y - p.y;
+        float dz = q.z - p.z;
+        if (dx * dx + dy * dy + dz * dz <= r2) {
+          f((uint64_t)rows_[j], q);
+        }
+      }
+    }
+  }
+
+  inline uint64_t size() const {
+    return rows_.size();
+  }
+
+  inline float cell_size() const {
+    return cell_size_;
+  }
+
+private:
+  static const uint64_t MIN_BUCKETS = 1 << 10;
+
+  // There are about as many buckets as rows, and every thread of a rebuild
+  // keeps a count per bucket, so only this many threads take part.
+  static const int MAX_REBUILD_THREADS = 8;
+
+  // A query with a radius of up to one cell touches 27 cells.
+  static const uint64_t MAX_SMALL_QUERY = 64;
+
+  inline int64_t cell(float v) const {
+    return (int64_t)std::floor(v * inv_cell_size_);
+  }
+
+  inline uint32_t bucket(int64_t x, int64_t y, int64_t z) const {
+    uint64_t h = (uint64_t)x * 73856093 ^ (uint64_t)y * 19349663 ^
+                 (uint64_t)z * 83492791;
+    return (uint32_t)(h & bucket_mask_);
+  }
+
+  const Table* table_;
+  Position position_;
+  float cell_size_;
+  float inv_cell_size_;
+  uint64_t bucket_mask_ = 0;
+
+  // Bucket of each row, in row order.
+  std::vector<uint32_t> buckets_;
+
+  // Rows and their positions sorted by bucket. Bucket b spans
+  // [starts_[b], starts_[b + 1]).
+  std::vector<uint32_t> rows_;
+  std::vector<Point> points_;
+  std::vector<uint32_t> starts_;
+
+  // Per thread bucket counts, bucket_count apart.
+  std::vector<uint32_t> counts_;
+};
+
+}  // namespace radiance
+
+#endif  // SPATIAL_INDEX__H
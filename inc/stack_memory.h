@@ -8,67 +8,112 @@
 #ifndef STACK_MEMORY__H
 #define STACK_MEMORY__H
 
+#include "arena.h"
 #include "common.h"
-#include <memory.h>
 
-static const int MAX_SIZE = 512;
+#include <cstddef>
+#include <memory.h>
+#include <new>
+#include <type_traits>
 
 namespace radiance
 {
 
+// A stack of values of any size on top of an Arena. Values are aligned for
+// any fundamental type unless a larger alignment is asked for.
 class Stack {
 private:
+  // Written right after each value. Frames are linked from the top down, so
+  // that a value can be freed even when the value below it is in another
+  // chunk of the arena.
   struct StackFrame {
     size_t size;
+    uint8_t* value;
+    StackFrame* prev;
+
+    // Where the arena was before the value was allocated.
+    Arena::Marker marker;
   };
 
-  uint8_t stack_[MAX_SIZE];
-  // Always points to the next empty piece of memory.
-  uint8_t* top_;
-  uint8_t* ceiling_;
+  Arena arena_;
+  StackFrame* top_ = nullptr;
+  Arena::Marker bottom_;
 
 public:
-  Stack() : top_(stack_), ceiling_(stack_ + MAX_SIZE) {}
+  Stack(size_t chunk_size = Arena::DEFAULT_CHUNK_SIZE) :
+      arena_(chunk_size), bottom_(arena_.mark()) {}
+
+  Stack(const Stack&) = delete;
+  Stack& operator=(const Stack&) = delete;
+
   ~Stack() {
     clear();
   }
 
   void* alloc(size_t type_size) {
-    void* ret = nullptr;
-
-    StackFrame frame{type_size};
-    uint8_t* new_top = top_ + type_size + sizeof(StackFrame);
-    if (new_top <= ceiling_) {
-      *(StackFrame*)(new_top - sizeof(StackFrame)) = frame;
-      ret = top_;
-      top_ = new_top;
-    }
+    return alloc(type_size, alignof(std::max_align_t));
+  }
+
+  // Align must be a power of two. Over-aligned types, e.g. SIMD vectors, can
+  // be placed in the returned memory.
+  void* alloc(size_t type_size, size_t align) {
+    // The frame after the value has to be aligned too.
+    align = align > alignof(StackFrame) ? align : alignof(StackFrame);
+    size_t padded = (type_size + alignof(StackFrame) - 1) &
+        ~(alignof(StackFrame) - 1);
+    Arena::Marker marker = arena_.mark();
+    uint8_t* value = (uint8_t*)arena_.alloc(padded + sizeof(StackFrame), align);
+    StackFrame* frame = (StackFrame*)(value + padded);
+    *frame = StackFrame{type_size, value, top_, marker};
+    top_ = frame;
+    return value;
+  }
 
-    DEBUG_ASSERT(ret, Status::Code::MEMORY_OUT_OF_BOUNDS);
-    return ret;
+  // Allocates count default initialized T as one value. The elements are
+  // never destroyed.
+  template<typename T>
+  T* alloc_array(size_t count) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "Elements on a Stack are not destroyed.");
+    T* array = (T*)alloc(count * sizeof(T), alignof(T));
+    for (size_t i = 0; i < count; ++i) {
+      new (array + i) T;
+    }
+    return array;
   }
 
   // Return pointer to value that is on the top of the stack.
   void* top() const {
-    void* ret = nullptr;
-
-    StackFrame* frame = (StackFrame*)(top_ - sizeof(StackFrame));
-    if ((uint8_t*)(frame) >= stack_) {
-      ret = top_ - sizeof(StackFrame) - frame->size;
-    }
+    return top_ ? top_->value : nullptr;
+  }
 
-    return ret;
+  // Return the size of the value that is on the top of the stack.
+  size_t top_size() const {
+    return top_ ? top_->size : 0;
   }
 
   void free() {
-    StackFrame* frame = (StackFrame*)(top_ - sizeof(StackFrame));
-    if ((uint8_t*)(frame) >= stack_) {
-      top_ = top_ - sizeof(StackFrame) - frame->size;
+    if (top_) {
+      StackFrame frame = *top_;
+      arena_.rewind(frame.marker);
+      top_ = frame.prev;
     }
   }
 
   void clear() {
-    top_ = stack_;
+    arena_.rewind(bottom_);
+    top_ = nullptr;
+  }
+
+  // Clears the stack and ends the arena's frame. See Arena::reset().
+  void reset() {
+    clear();
+    arena_.reset();
+    bottom_ = arena_.mark();
+  }
+
+  inline const Arena::Stats& stats() const {
+    return arena_.stats();
   }
 };
 
@@ -8,57 +8,124 @@
 #ifndef SYSTEM__H
 #define SYSTEM__H
 
-#include <functional>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <omp.h>
+
 #include "common.h"
 #include "frame.h"
 
 namespace radiance
 {
 
+// A callable that takes a Frame*. The callable is stored inline, without
+// allocating, and must be trivially copyable, so that a System can be
+// copied and moved as plain bytes. Lambdas that capture pointers and values
+// of plain types qualify.
 class System {
+public:
+  // Largest callable a System can hold.
+  static const size_t CAPACITY = 48;
+
 private:
-  typedef std::function<void(Frame*)> Function;
-  Function f_;
+  typedef void (*Invoke)(const void* state, Frame* frame);
+
+  template<typename Function_>
+  static void invoke(const void* state, Frame* frame) {
+    (*(const Function_*)state)(frame);
+  }
+
+  static void noop(const void*, Frame*) {}
+
+  alignas(std::max_align_t) uint8_t state_[CAPACITY] = {};
+  Invoke invoke_ = noop;
 
 public:
   template<typename Function_, typename... State_>
   static System Bind(Function_ f, State_... state) {
-    System s;
-    s.f_ = [=](Frame* frame) {
-      return f(frame, state...);
-    };
-    return s;
+    return System([=](Frame* frame) {
+      f(frame, state...);
+    });
   }
 
-  System() {
-    f_ = [](Frame*){};
-  }
+  System() {}
 
-  template<typename Function_>
-  System(Function_ f) : f_(f) {}
-
-  /*
-  template<typename Function_, typename... State_>
-  System(Function_ f, State_... state) {
-    f_ = [=](Frame* frame) {
-      return f(frame, state...);
-    };
-  }*/
+  template<typename Function_, typename = typename std::enable_if<
+      !std::is_same<typename std::decay<Function_>::type, System>::value>::type>
+  System(Function_ f) {
+    static_assert(sizeof(Function_) <= CAPACITY,
+                  "Callable is too large for a System.");
+    static_assert(alignof(Function_) <= alignof(std::max_align_t),
+                  "Callable is over-aligned for a System.");
+    static_assert(std::is_trivially_copyable<Function_>::value,
+                  "Callable must be trivially copyable to be a System.");
+    new (state_) Function_(f);
+    invoke_ = invoke<Function_>;
+  }
 
   inline void operator()(Frame* frame) const {
-    f_(frame);
+    invoke_(state_, frame);
   }
 };
 
 typedef std::vector<System> SystemList;
 
+// What a System reads and writes, named by Id, e.g. the id of a Collection.
+// Two systems conflict if either one writes something that the other reads
+// or writes.
+struct Access {
+  std::vector<Id> reads;
+  std::vector<Id> writes;
+
+  // Conflicts with every other system. Systems pushed without an Access are
+  // exclusive.
+  bool exclusive = false;
+
+  static Access Exclusive() {
+    Access a;
+    a.exclusive = true;
+    return a;
+  }
+
+  bool conflicts(const Access& other) const {
+    if (exclusive || other.exclusive) {
+      return true;
+    }
+    return overlaps(writes, other.writes) || overlaps(writes, other.reads) ||
+           overlaps(reads, other.writes);
+  }
+
+ private:
+  static bool overlaps(const std::vector<Id>& a, const std::vector<Id>& b) {
+    for (Id x : a) {
+      if (std::find(b.begin(), b.end(), x) != b.end()) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+// Runs systems in parallel where their Access allows. Systems are split into
+// stages: each system goes in the stage after the last stage that holds a
+// conflicting system pushed before it. The systems in one stage run at the
+// same time on the OpenMP threads, each with that thread's Frame. A system
+// that is alone in its stage, e.g. one pushed without an Access, runs on the
+// calling thread with the Frame passed in, which the callback then sees.
+// Conflicting systems run in the order they were pushed.
 class SystemExecutor {
  public:
   struct Element {
     Id id;
     System system;
+    Access access;
   };
 
   typedef std::vector<Element> Systems;
@@ -68,11 +135,29 @@ class SystemExecutor {
   SystemExecutor() {}
   SystemExecutor(System callback): callback_(callback) {}
 
-  void operator()(Frame* frame) const {
-    for(auto& el : systems_) {
-      el.system(frame);
+  SystemExecutor(const SystemExecutor&) = delete;
+  SystemExecutor& operator=(const SystemExecutor&) = delete;
+
+  // Runs every system, then the callback with frame. The per thread Frames
+  // of the parallel stages are reset afterwards.
+  void operator()(Frame* frame) {
+    schedule();
+    for (const std::vector<size_t>& stage : stages_) {
+      if (stage.size() == 1) {
+        systems_[stage[0]].system(frame);
+        continue;
+      }
+
+#pragma omp parallel for schedule(dynamic, 1)
+      for (size_t i = 0; i < stage.size(); ++i) {
+        systems_[stage[i]].system(worker_frame());
+      }
     }
     callback_(frame);
+
+    for (auto& f : frames_) {
+      f->reset();
+    }
   }
 
   std::vector<Id> push(std::vector<System> systems) {
@@ -84,51 +169,186 @@ class SystemExecutor {
     return ret;
   }
 
+  Id push(System system, Access access = Access::Exclusive()) {
+    compact();
+    Id new_id = id_++;
+    index_[new_id] = systems_.size();
+    systems_.push_back({new_id, system, std::move(access)});
+    dirty_ = true;
+    return new_id;
+  }
+
   System& callback() {
     return callback_;
   }
 
   void erase(iterator it) {
-    systems_.erase(it);
+    erase(it->id);
   }
 
+  // Constant time. The system is only taken out of the list the next time
+  // the list is used.
   void erase(Id id) {
-    iterator it = begin();
-    while(it != end()) {
-      if (it->id == id) {
-        break;
-      }
+    auto found = index_.find(id);
+    if (found == index_.end()) {
+      return;
     }
+    erased_.push_back(found->second);
+    index_.erase(found);
+    dirty_ = true;
+  }
+
+  // The number of stages the systems are run in.
+  size_t stages() {
+    schedule();
+    return stages_.size();
+  }
+
+  size_t size() const {
+    return index_.size();
   }
 
   iterator begin() {
+    compact();
     return systems_.begin();
   }
 
   iterator end() {
+    compact();
     return systems_.end();
   }
 
   const_iterator begin() const {
+    compact();
     return systems_.begin();
   }
 
   const_iterator end() const {
+    compact();
     return systems_.end();
   }
 
  private:
-  Id push(System system) {
-    Id new_id = id_++;  
-    systems_.push_back({new_id, system});
-    return new_id;
+  Frame* worker_frame() {
+    return frames_[omp_get_thread_num()].get();
+  }
+
+  // Drops erased systems, keeping the others in order.
+  void compact() const {
+    if (erased_.empty()) {
+      return;
+    }
+    std::sort(erased_.begin(), erased_.end());
+    size_t next = 0;
+    size_t to = 0;
+    for (size_t from = 0; from < systems_.size(); ++from) {
+      if (next < erased_.size() && erased_[next] == from) {
+        ++next;
+        continue;
+      }
+      if (to != from) {
+        systems_[to] = std::move(systems_[from]);
+      }
+      index_[systems_[to].id] = to;
+      ++to;
+    }
+    systems_.resize(to);
+    erased_.clear();
+  }
+
+  void schedule() {
+    compact();
+    size_t threads = omp_get_max_threads();
+    while (frames_.size() < threads) {
+      frames_.emplace_back(new Frame());
+    }
+    if (!dirty_) {
+      return;
+    }
+
+    stages_.clear();
+    std::vector<size_t> stage_of(systems_.size());
+
+    // Nothing can be scheduled before the last exclusive system, so only the
+    // systems after it are compared.
+    size_t barrier = 0;
+    for (size_t i = 0; i < systems_.size(); ++i) {
+      size_t stage = 0;
+      if (systems_[i].access.exclusive) {
+        stage = stages_.size();
+        barrier = i;
+      } else {
+        for (size_t j = barrier; j < i; ++j) {
+          if (stage_of[j] + 1 > stage &&
+              systems_[i].access.conflicts(systems_[j].access)) {
+            stage = stage_of[j] + 1;
+          }
+        }
+      }
+      stage_of[i] = stage;
+      if (stage == stages_.size()) {
+        stages_.emplace_back();
+      }
+      stages_[stage].push_back(i);
+    }
+    dirty_ = false;
   }
 
-  Systems systems_;
+  // Erasing only marks systems, compact() removes them.
+  mutable Systems systems_;
+  mutable std::unordered_map<Id, size_t> index_;
+  mutable std::vector<size_t> erased_;
+
+  // Indices into systems_ of the systems in each stage.
+  std::vector<std::vector<size_t>> stages_;
+  bool dirty_ = false;
+
+  std::vector<std::unique_ptr<Frame>> frames_;
+
   System callback_ = [](Frame*){};
-  Id id_;
+  Id id_ = 0;
+};
+
+// Runs a fixed set of systems in order. The systems are stored by type in a
+// tuple and called directly, so the compiler can inline the whole frame. Use
+// make_static_executor to deduce the types, e.g.
+//
+//   auto executor = make_static_executor(
+//       [&](Frame*) { move(); }, [&](Frame*) { collide(); });
+//   executor(&frame);
+template<typename... Systems_>
+class StaticSystemExecutor {
+ public:
+  StaticSystemExecutor(Systems_... systems) : systems_(std::move(systems)...) {}
+
+  inline void operator()(Frame* frame) {
+    run(frame, std::index_sequence_for<Systems_...>());
+  }
+
+  template<size_t Index_>
+  inline typename std::tuple_element<Index_, std::tuple<Systems_...>>::type& get() {
+    return std::get<Index_>(systems_);
+  }
+
+  static constexpr size_t size() {
+    return sizeof...(Systems_);
+  }
+
+ private:
+  template<size_t... Indices_>
+  inline void run(Frame* frame, std::index_sequence<Indices_...>) {
+    int calls[] = {0, (std::get<Indices_>(systems_)(frame), 0)...};
+    (void)calls;
+  }
+
+  std::tuple<Systems_...> systems_;
 };
 
+template<typename... Systems_>
+StaticSystemExecutor<Systems_...> make_static_executor(Systems_... systems) {
+  return StaticSystemExecutor<Systems_...>(std::move(systems)...);
+}
+
 }  // namespace radiance
 
 #endif
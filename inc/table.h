@@ -12,7 +12,10 @@
 #define _ENABLE_ATOMIC_ALIGNMENT_FIX
 #endif
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <iterator>
 
 #include <boost/lockfree/queue.hpp>
 #include <vector>
@@ -42,7 +45,32 @@ struct BaseElement {
   Value_ value;
 };
 
-template <typename Key_, typename Value_, typename Allocator_ = std::allocator<Value_>>
+// Table storage policy: keys and values each in one std::vector. Element
+// addresses change when the table grows. See PagedStorage for the
+// alternative.
+struct VectorStorage {
+  template<typename T>
+  using Array = std::vector<T>;
+};
+
+// std::vector::shrink_to_fit does nothing when built without exceptions, so
+// vectors are shrunk by moving them into one of the right size.
+template<typename T, typename Allocator_>
+void shrink_array(std::vector<T, Allocator_>* v) {
+  if (v->capacity() > v->size()) {
+    std::vector<T, Allocator_>(std::make_move_iterator(v->begin()),
+                               std::make_move_iterator(v->end()),
+                               v->get_allocator()).swap(*v);
+  }
+}
+
+template<typename Array_>
+void shrink_array(Array_* a) {
+  a->shrink_to_fit();
+}
+
+template <typename Key_, typename Value_, typename Allocator_ = std::allocator<Value_>,
+          typename Storage_ = VectorStorage>
 class Table {
 public:
   typedef Key_ Key;
@@ -50,16 +78,31 @@ public:
 
   typedef BaseElement<Key, Value> Element;
 
-  typedef std::vector<Key> Keys;
-  typedef std::vector<Value> Values;
+  struct Mutation {
+    MutateBy mutate_by;
+    Element el;
+  };
+
+  typedef typename Storage_::template Array<Key> Keys;
+  typedef typename Storage_::template Array<Value> Values;
 
-  // For fast lookup if you have the handle to an entity.
-  typedef std::vector<uint64_t> Handles;
-  typedef std::vector<Handle> FreeHandles;
+  // For fast lookup if you have the handle to an entity. Maps a handle's slot
+  // to its row and the slot's current generation, side by side so that a
+  // checked lookup costs no extra cache miss.
+  struct Slot {
+    uint64_t row;
+    uint32_t generation;
+  };
+  typedef std::vector<Slot> Handles;
+  typedef std::vector<uint64_t> FreeHandles;
 
   // For fast lookup by Entity Id.
   typedef std::map<Key, Handle> Index;
 
+  // Maps a row to the value rows are ordered by in reorder(). Use this to
+  // keep spatially close elements close in memory, e.g. with a Morton code.
+  typedef uint64_t (*Locality)(const Key&, const Value&);
+
   Table() {}
 
   Table(std::vector<std::tuple<Key, Value>>&& init_data) {
@@ -72,9 +115,11 @@ public:
     Handle handle = make_handle();
 
     index_[key] = handle;
+    rows_.push_back(handle);
 
     values.push_back(std::move(value));
     keys.push_back(key);
+    insert_into_indexes(handle, values.back());
     return handle;
   }
 
@@ -82,9 +127,11 @@ public:
     Handle handle = make_handle();
 
     index_[key] = handle;
+    rows_.push_back(handle);
 
     values.push_back(value);
     keys.push_back(key);
+    insert_into_indexes(handle, values.back());
     return handle;
   }
 
@@ -92,9 +139,11 @@ public:
     Handle handle = make_handle();
 
     index_[key] = handle;
+    rows_.push_back(handle);
 
     values.push_back(value);
     keys.push_back(key);
+    insert_into_indexes(handle, values.back());
     return handle;
   }
 
@@ -102,18 +151,37 @@ public:
     Handle handle = make_handle();
 
     index_[key] = handle;
+    rows_.push_back(handle);
 
     values.push_back(std::move(value));
     keys.push_back(key);
+    insert_into_indexes(handle, values.back());
     return handle;
   }
 
+  // Unchecked, the handle must be valid.
   Value& operator[](Handle handle) {
-    return values[handles_[handle]];
+    return values[handles_[handle_slot(handle)].row];
   }
 
   const Value& operator[](Handle handle) const {
-    return values[handles_[handle]];
+    return values[handles_[handle_slot(handle)].row];
+  }
+
+  // Whether handle refers to an element that is still in the table.
+  inline bool valid(Handle handle) const {
+    uint64_t slot = handle_slot(handle);
+    return handle >= 0 && slot < handles_.size() &&
+           handles_[slot].generation == handle_generation(handle);
+  }
+
+  // Returns nullptr if the handle is stale.
+  inline Value* get(Handle handle) {
+    return valid(handle) ? &values[handles_[handle_slot(handle)].row] : nullptr;
+  }
+
+  inline const Value* get(Handle handle) const {
+    return valid(handle) ? &values[handles_[handle_slot(handle)].row] : nullptr;
   }
 
   Handle find(Key&& key) const {
@@ -152,51 +220,421 @@ public:
     return values.size();
   }
 
+  // Returns -1 if the handle is stale.
   int64_t remove(Handle handle) {
-    Handle h_from = handle;
-    uint64_t& i_from = handles_[h_from];
-    Key& k_from = keys[i_from];
+    if (!valid(handle)) {
+      return -1;
+    }
+    uint64_t row = handles_[handle_slot(handle)].row;
+    uint64_t last = keys.size() - 1;
+    Handle moved = rows_[last];
 
-    Key& k_to = keys.back();
-    Handle h_to = index_[k_to];
-    uint64_t& i_to = handles_[h_to];
+    for (const IndexHooks& i : indexes_) {
+      i.remove(i.index, handle, values[row]);
+    }
+    index_.erase(keys[row]);
+    release_handle(handle);
 
-    Value& c_from = values[i_from];
-    Value& c_to = values[i_to];
+    std::swap(keys[row], keys[last]); keys.pop_back();
+    std::swap(values[row], values[last]); values.pop_back();
+    handles_[handle_slot(moved)].row = row;
+    rows_[row] = moved; rows_.pop_back();
 
-    release_handle(h_from);
+    ++version_;
+    return 0;
+  }
 
-    index_.erase(k_from);
-    std::swap(i_from, i_to);
-    std::swap(k_from, k_to); keys.pop_back();
-    std::swap(c_from, c_to); values.pop_back();
+  // Replaces the contents of the table with count rows, e.g. from a snapshot
+  // or a compaction. Elements whose key is still in the table keep their
+  // handle, the handles of the others go stale. Keys that come in ascending
+  // order are indexed in constant time each.
+  void assign(const Key* new_keys, const Value* new_values, uint64_t count) {
+    keys.assign(new_keys, new_keys + count);
+    values.assign(new_values, new_values + count);
+
+    Index old_index;
+    old_index.swap(index_);
+    rows_.assign(count, -1);
+
+    // The old index is walked alongside keys that come in ascending order,
+    // and searched for the others.
+    typename Index::key_compare less = old_index.key_comp();
+    typename Index::iterator it = old_index.begin();
+    for (uint64_t i = 0; i < count; ++i) {
+      if (i > 0 && less(keys[i], keys[i - 1])) {
+        it = old_index.lower_bound(keys[i]);
+      }
+      while (it != old_index.end() && less(it->first, keys[i])) {
+        ++it;
+      }
+      if (it != old_index.end() && !less(keys[i], it->first)) {
+        rows_[i] = it->second;
+        handles_[handle_slot(it->second)].row = i;
+        it = old_index.erase(it);
+      }
+    }
+    for (const auto& dropped : old_index) {
+      release_handle(dropped.second);
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+      if (rows_[i] < 0) {
+        rows_[i] = make_handle(i);
+      }
+      index_.emplace_hint(index_.end(), keys[i], rows_[i]);
+    }
 
-    return 0;
+    for (const IndexHooks& i : indexes_) {
+      i.clear(i.index);
+      for (uint64_t row = 0; row < count; ++row) {
+        i.insert(i.index, rows_[row], values[row]);
+      }
+    }
+    ++version_;
+  }
+
+  // Assigns a new value to an element and updates the secondary indexes.
+  // Returns false if the handle is stale.
+  bool update(Handle handle, Value&& value) {
+    if (!valid(handle)) {
+      return false;
+    }
+    update_at(handles_[handle_slot(handle)].row, std::move(value));
+    return true;
+  }
+
+  bool update(Handle handle, const Value& value) {
+    return update(handle, Value(value));
+  }
+
+  // Same as update() but by row.
+  void update_at(uint64_t index, Value&& value) {
+    if (indexes_.empty()) {
+      values[index] = std::move(value);
+      return;
+    }
+    for (const IndexHooks& i : indexes_) {
+      i.update(i.index, rows_[index], values[index], value);
+    }
+    values[index] = std::move(value);
+  }
+
+  inline uint64_t row(Handle handle) const {
+    return handles_[handle_slot(handle)].row;
+  }
+
+  inline Handle handle(uint64_t index) const {
+    return rows_[index];
+  }
+
+  // Registers a secondary index, e.g. a HashIndex or a SortedIndex, and adds
+  // every element to it. The index must outlive its registration.
+  template<typename Index_>
+  void add_index(Index_* index) {
+    IndexHooks hooks;
+    hooks.index = index;
+    hooks.insert = [](void* index, Handle handle, const Value& value) {
+      ((Index_*)index)->insert(handle, value);
+    };
+    hooks.remove = [](void* index, Handle handle, const Value& value) {
+      ((Index_*)index)->remove(handle, value);
+    };
+    hooks.update = [](void* index, Handle handle, const Value& old_value,
+                      const Value& new_value) {
+      ((Index_*)index)->update(handle, old_value, new_value);
+    };
+    hooks.clear = [](void* index) {
+      ((Index_*)index)->clear();
+    };
+    indexes_.push_back(hooks);
+    for (uint64_t row = 0; row < size(); ++row) {
+      index->insert(rows_[row], values[row]);
+    }
+  }
+
+  void remove_index(void* index) {
+    indexes_.erase(
+        std::remove_if(indexes_.begin(), indexes_.end(),
+                       [=](const IndexHooks& i) { return i.index == index; }),
+        indexes_.end());
+  }
+
+  void set_locality(Locality locality) {
+    locality_ = locality;
+    reorder_.phase = Reordering::Phase::IDLE;
+  }
+
+  // Incrementally sorts the rows by key, or by the Locality function if one is
+  // set, spending at most roughly budget_ns per call. Progress is kept between
+  // calls so this can be run in the gaps between frames. Handles stay valid,
+  // raw row offsets do not. Returns true when the table is fully ordered.
+  bool reorder(uint64_t budget_ns) {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point deadline =
+        Clock::now() + std::chrono::nanoseconds(budget_ns);
+    const uint64_t STEPS_PER_CLOCK_CHECK = 256;
+
+    // A pass is only valid for the rows it was started with.
+    if (reorder_.phase != Reordering::Phase::IDLE &&
+        reorder_.version != version_) {
+      reorder_.phase = Reordering::Phase::IDLE;
+    }
+
+    if (reorder_.phase == Reordering::Phase::IDLE) {
+      // Nothing could have moved out of order if there have been no inserts
+      // or removes, unless the order depends on the values.
+      if (reorder_.sorted && reorder_.version == version_ && !locality_) {
+        return true;
+      }
+      reorder_.phase = Reordering::Phase::GATHER;
+      reorder_.version = version_;
+      reorder_.sorted = false;
+      reorder_.cursor = 0;
+      reorder_.order.clear();
+      reorder_.locality.clear();
+      reorder_.scratch.clear();
+    }
+
+    uint64_t n = size();
+    uint64_t steps = 0;
+    auto out_of_time = [&]() {
+      return ++steps % STEPS_PER_CLOCK_CHECK == 0 && Clock::now() >= deadline;
+    };
+
+    // Rows are not moved until the APPLY phase, so comparing handles by their
+    // current row is stable throughout the sort.
+    auto less = [this](Handle a, Handle b) {
+      if (locality_) {
+        return reorder_.locality[row(a)] < reorder_.locality[row(b)];
+      }
+      return keys[row(a)] < keys[row(b)];
+    };
+
+    if (reorder_.phase == Reordering::Phase::GATHER) {
+      reorder_.order.reserve(n);
+      reorder_.scratch.reserve(n);
+      if (locality_) {
+        reorder_.locality.reserve(n);
+      }
+      for (; reorder_.cursor < n; ++reorder_.cursor) {
+        if (out_of_time()) {
+          return false;
+        }
+        reorder_.order.push_back(rows_[reorder_.cursor]);
+        if (locality_) {
+          reorder_.locality.push_back(
+              locality_(keys[reorder_.cursor], values[reorder_.cursor]));
+        }
+      }
+      reorder_.phase = Reordering::Phase::SORT_RUNS;
+      reorder_.cursor = 0;
+    }
+
+    // The merge buffer grows a run at a time along with the sort, so that no
+    // single call has to fill all of it.
+    if (reorder_.phase == Reordering::Phase::SORT_RUNS) {
+      for (; reorder_.cursor < n; reorder_.cursor += Reordering::RUN_SIZE) {
+        if (Clock::now() >= deadline) {
+          return false;
+        }
+        uint64_t run_end = std::min(reorder_.cursor + Reordering::RUN_SIZE, n);
+        std::sort(reorder_.order.begin() + reorder_.cursor,
+                  reorder_.order.begin() + run_end, less);
+        reorder_.scratch.resize(run_end);
+      }
+      reorder_.phase = Reordering::Phase::MERGE;
+      reorder_.width = Reordering::RUN_SIZE;
+      reorder_.lo = 0;
+      reorder_.begin_merge(n);
+    }
+
+    // Bottom-up merge of the sorted runs. The position inside the current
+    // merge is kept so that a single large merge can span several calls.
+    if (reorder_.phase == Reordering::Phase::MERGE) {
+      std::vector<Handle>& src = reorder_.order;
+      std::vector<Handle>& dst = reorder_.scratch;
+      while (reorder_.width < n) {
+        while (reorder_.lo < n) {
+          while (reorder_.k < reorder_.hi) {
+            if (out_of_time()) {
+              return false;
+            }
+            if (reorder_.j >= reorder_.hi ||
+                (reorder_.i < reorder_.mid && !less(src[reorder_.j], src[reorder_.i]))) {
+              dst[reorder_.k++] = src[reorder_.i++];
+            } else {
+              dst[reorder_.k++] = src[reorder_.j++];
+            }
+          }
+          reorder_.lo = reorder_.hi;
+          reorder_.begin_merge(n);
+        }
+        std::swap(src, dst);
+        reorder_.width *= 2;
+        reorder_.lo = 0;
+        reorder_.begin_merge(n);
+      }
+      reorder_.phase = Reordering::Phase::APPLY;
+      reorder_.cursor = 0;
+    }
+
+    if (reorder_.phase == Reordering::Phase::APPLY) {
+      for (; reorder_.cursor < n; ++reorder_.cursor) {
+        if (out_of_time()) {
+          return false;
+        }
+        swap_rows(reorder_.cursor, row(reorder_.order[reorder_.cursor]));
+      }
+      reorder_.phase = Reordering::Phase::IDLE;
+      reorder_.sorted = true;
+    }
+
+    return true;
+  }
+
+  // Frees the capacity that is not in use. Moves the keys and values if they
+  // are stored in one array, so it must not run while they are being read.
+  void shrink_to_fit() {
+    shrink_array(&keys);
+    shrink_array(&values);
+    shrink_array(&rows_);
+    shrink_array(&handles_);
+    shrink_array(&free_handles_);
+    if (reorder_.phase == Reordering::Phase::IDLE) {
+      reorder_.order = std::vector<Handle>();
+      reorder_.scratch = std::vector<Handle>();
+      reorder_.locality = std::vector<uint64_t>();
+    }
   }
 
   Keys keys;
   Values values;
 
 private:
+  struct Reordering {
+    enum class Phase {
+      IDLE = 0,
+      GATHER,
+      SORT_RUNS,
+      MERGE,
+      APPLY,
+    };
+
+    // Number of rows sorted in one go before merging.
+    static const uint64_t RUN_SIZE = 1 << 10;
+
+    void begin_merge(uint64_t n) {
+      mid = std::min(lo + width, n);
+      hi = std::min(lo + 2 * width, n);
+      i = lo;
+      j = mid;
+      k = lo;
+    }
+
+    Phase phase = Phase::IDLE;
+    bool sorted = false;
+    uint64_t version = 0;
+    uint64_t cursor = 0;
+
+    uint64_t width = 0;
+    uint64_t lo = 0, mid = 0, hi = 0;
+    uint64_t i = 0, j = 0, k = 0;
+
+    std::vector<Handle> order;
+    std::vector<Handle> scratch;
+    std::vector<uint64_t> locality;
+  };
+
+  struct IndexHooks {
+    void* index;
+    void (*insert)(void*, Handle, const Value&);
+    void (*remove)(void*, Handle, const Value&);
+    void (*update)(void*, Handle, const Value&, const Value&);
+    void (*clear)(void*);
+  };
+
+  inline void insert_into_indexes(Handle handle, const Value& value) {
+    for (const IndexHooks& i : indexes_) {
+      i.insert(i.index, handle, value);
+    }
+  }
+
   Handle make_handle() {
+    ++version_;
+    return make_handle(keys.size());
+  }
+
+  // Takes a free slot, or a new one, for the element at row.
+  Handle make_handle(uint64_t row) {
     if (free_handles_.size()) {
-      Handle h = free_handles_.back();
+      uint64_t slot = free_handles_.back();
       free_handles_.pop_back();
-      return h;
+      handles_[slot].row = row;
+      return pack_handle(slot, handles_[slot].generation);
     }
-    handles_.push_back(handles_.size());
-    return handles_.back();
+    handles_.push_back(Slot{row, 0});
+    return pack_handle(handles_.size() - 1, 0);
   }
 
+  // Bumps the slot's generation so that outstanding handles to it go stale.
   void release_handle(Handle h) {
-    free_handles_.push_back(h);
+    uint64_t slot = handle_slot(h);
+    handles_[slot].generation =
+        (handles_[slot].generation + 1) & HANDLE_GENERATION_MASK;
+    free_handles_.push_back(slot);
+  }
+
+  void swap_rows(uint64_t a, uint64_t b) {
+    if (a == b) {
+      return;
+    }
+    std::swap(keys[a], keys[b]);
+    std::swap(values[a], values[b]);
+    std::swap(rows_[a], rows_[b]);
+    handles_[handle_slot(rows_[a])].row = a;
+    handles_[handle_slot(rows_[b])].row = b;
   }
 
   Handles handles_;
   FreeHandles free_handles_;
   Index index_;
+
+  // The handle of each row, the inverse of handles_.
+  std::vector<Handle> rows_;
+
+  // Incremented on every insert and remove.
+  uint64_t version_ = 0;
+
+  Locality locality_ = nullptr;
+  Reordering reorder_;
+
+  std::vector<IndexHooks> indexes_;
 };
 
+// Collection::bind hook for a Table that keeps its keys and values in one
+// array each.
+template<typename Table_>
+void bind_table(Collection* c) {
+  Table_* t = (Table_*)c->collection;
+  c->keys.data = (uint8_t*)t->keys.data();
+  c->values.data = (uint8_t*)t->values.data();
+}
+
+// Collection::shrink hook for any Table.
+template<typename Table_>
+void shrink_table(Collection* c) {
+  ((Table_*)c->collection)->shrink_to_fit();
+}
+
+// Collection::load hook for any Table, e.g. the sink of a Reduction or a
+// compaction. See Table::assign for what happens to handles.
+template<typename Table_>
+void load_table(Collection* c, const uint8_t* keys, const uint8_t* values,
+                uint64_t count) {
+  ((Table_*)c->collection)->assign((const typename Table_::Key*)keys,
+                                   (const typename Table_::Value*)values,
+                                   count);
+}
+
 template <typename Table_>
 class View {
 public:
@@ -243,34 +681,35 @@ public:
 
   MutationBuffer() : mutations_(INITIAL_SIZE) {}
 
-  const std::function<void(Table*, Mutation&&)> default_resolver = 
-    [=](Table* table, Mutation&& m) {
-        switch (m.mutate_by) {
-          case MutateBy::INSERT:
-            table->insert(std::move(m.el.key), std::move(m.el.value));
+  static void resolve(Table* table, Mutation&& m) {
+    switch (m.mutate_by) {
+      case MutateBy::INSERT:
+        table->insert(std::move(m.el.key), std::move(m.el.value));
+        break;
+      case MutateBy::REMOVE:
+        table->remove(table->find(m.el.key));
+        break;
+      case MutateBy::UPDATE:
+        switch (m.el.indexed_by) {
+          case IndexedBy::HANDLE:
+            table->update(m.el.handle, std::move(m.el.value));
             break;
-          case MutateBy::REMOVE:
-            table->remove(table->find(m.el.key));
+          case IndexedBy::KEY:
+            table->update(table->find(m.el.key), std::move(m.el.value));
             break;
-          case MutateBy::UPDATE:
-            switch (m.el.indexed_by) {
-              case IndexedBy::HANDLE:
-                (*table)[m.el.handle] = std::move(m.el.value);
-                break;
-              case IndexedBy::KEY:
-                table->values[table->find(m.el.key)] = std::move(m.el.value);
-                break;
-              case IndexedBy::OFFSET:
-                table->values[m.el.offset] = std::move(m.el.value);
-                break;
-              default:
-                break;
-            }
+          case IndexedBy::OFFSET:
+            table->update_at(m.el.offset, std::move(m.el.value));
             break;
           default:
             break;
         }
-      };
+        break;
+      default:
+        break;
+    }
+  }
+
+  const std::function<void(Table*, Mutation&&)> default_resolver = resolve;
 
   bool push(Mutation&& m) {
     return mutations_.push(m);
@@ -287,14 +726,48 @@ public:
          });
   }
 
+  // Every mutation applied by flush() is first appended to the log, e.g. a
+  // MutationLog, and the log is committed after each flush. Pass nullptr to
+  // stop logging.
+  template<typename Log_>
+  void set_log(Log_* log) {
+    log_ = log;
+    log_append_ = [](void* log, const Table* table, const Mutation& m) {
+      ((Log_*)log)->append(table, m);
+    };
+    log_commit_ = [](void* log) {
+      ((Log_*)log)->commit();
+    };
+  }
+
+  void set_log(std::nullptr_t) {
+    log_ = nullptr;
+  }
+
   uint64_t flush(Table* table) {
+    if (log_) {
+      uint64_t ret = mutations_.consume_all([&](Mutation& m) {
+        log_append_(log_, table, m);
+        resolve(table, std::move(m));
+      });
+      log_commit_(log_);
+      return ret;
+    }
     return mutations_.consume_all([&](Mutation& m) {
-      default_resolver(table, std::move(m));
+      resolve(table, std::move(m));
     });
   }
 
   template<typename Resolver_>
   uint64_t flush(Table* table, Resolver_ r) {
+    if (log_) {
+      uint64_t ret = mutations_.consume_all([this, table, r](Mutation m) {
+        log_append_(log_, table, m);
+        r(table, std::move(m));
+      });
+      log_commit_(log_);
+      return ret;
+    }
     return mutations_.consume_all([=](Mutation m) {
       r(table, std::move(m));
     });
@@ -302,6 +775,10 @@ public:
 
 private:
   ::boost::lockfree::queue<Mutation> mutations_;
+
+  void* log_ = nullptr;
+  void (*log_append_)(void*, const Table*, const Mutation&) = nullptr;
+  void (*log_commit_)(void*) = nullptr;
 };
 
 
@@ -0,0 +1,143 @@
+#ifndef TASK__H
+#define TASK__H
+
+// Coroutine jobs. Needs C++20, e.g. `make cpp20`; the rest of the library
+// still builds as C++14.
+#if __cplusplus > 201703L && __has_include(<coroutine>)
+
+#include "radiance.h"
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+
+namespace radiance {
+
+// A coroutine that runs as a Job, so that long work is spread over frames
+// without a thread of its own:
+//
+//   Task find_path(Grid* grid, Path* path) {
+//     while (!path->done) {
+//       expand(grid, path);
+//       co_await next_slice();
+//     }
+//   }
+//
+//   spawn(find_path(&grid, &path), 500000);
+//
+// A Task is started by the first loop() after it is spawned, and the job is
+// removed once the coroutine returns.
+class Task {
+ public:
+  struct promise_type {
+    // Steady clock time at which this frame's slice is used up.
+    uint64_t deadline_ns = 0;
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+
+    std::suspend_always final_suspend() noexcept {
+      return {};
+    }
+
+    void return_void() {}
+
+    void unhandled_exception() {
+      std::terminate();
+    }
+  };
+
+  typedef std::coroutine_handle<promise_type> Handle;
+
+  Task(Task&& other) : handle_(other.handle_) {
+    other.handle_ = nullptr;
+  }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  ~Task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  // Gives up ownership of the coroutine.
+  Handle release() {
+    Handle ret = handle_;
+    handle_ = nullptr;
+    return ret;
+  }
+
+ private:
+  explicit Task(Handle handle) : handle_(handle) {}
+
+  Handle handle_;
+};
+
+inline uint64_t steady_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Suspends the task until the next frame.
+struct NextFrame {
+  bool await_ready() const noexcept {
+    return false;
+  }
+  void await_suspend(std::coroutine_handle<>) const noexcept {}
+  void await_resume() const noexcept {}
+};
+
+inline NextFrame next_frame() {
+  return {};
+}
+
+// Suspends the task until the next frame if it has used up this frame's
+// budget, and carries on otherwise. Cheap enough to await once per step of
+// the work.
+struct NextSlice {
+  bool await_ready() const noexcept {
+    return false;
+  }
+  bool await_suspend(Task::Handle handle) const noexcept {
+    return steady_now_ns() >= handle.promise().deadline_ns;
+  }
+  void await_resume() const noexcept {}
+};
+
+inline NextSlice next_slice() {
+  return {};
+}
+
+// Adds the task as a job that may take budget_ns each frame, zero for no
+// limit. The job owns the coroutine from then on.
+inline Job* spawn(Task task, uint64_t budget_ns = 0) {
+  Job* job = add_job();
+  if (!job) {
+    return nullptr;
+  }
+  job->state = task.release().address();
+  job->budget_ns = budget_ns;
+  job->resume = [](Job* job, uint64_t budget_ns) -> bool {
+    Task::Handle handle = Task::Handle::from_address(job->state);
+    handle.promise().deadline_ns =
+        budget_ns ? steady_now_ns() + budget_ns : UINT64_MAX;
+    handle.resume();
+    return handle.done();
+  };
+  job->release = [](Job* job) {
+    Task::Handle::from_address(job->state).destroy();
+  };
+  return job;
+}
+
+}  // namespace radiance
+
+#endif  // C++20
+#endif  // TASK__H
@@ -1,11 +1,48 @@
 #ifndef UNIVERSE__H
 #define UNIVERSE__H
 
+#include <cstdint>
+
 namespace radiance {
 
+// How a worker that has run out of rows waits for the rest of a pipeline run.
+enum class IdleStrategy {
+  UNKNOWN = 0,
+  // Leave it to the OpenMP runtime, see OMP_WAIT_POLICY.
+  RUNTIME,
+  // Busy wait. Lowest latency, but the CPU is never given up.
+  SPIN,
+  // Busy wait for spin_ns, then sleep until the run is over.
+  SPIN_THEN_PARK,
+  // Sleep until the run is over.
+  PARK,
+};
+
+// The threads that run pipelines. Between loop() calls idle workers are held
+// by the OpenMP runtime, so also set OMP_WAIT_POLICY=passive to keep them off
+// of the CPU then.
+struct ExecutorConfig {
+  // Zero uses the OpenMP default. Worker 0 is the thread that calls loop().
+  uint32_t workers = 0;
+
+  // Optional. Pins worker i to cpus[i % cpu_count].
+  const int* cpus = nullptr;
+  uint32_t cpu_count = 0;
+
+  IdleStrategy idle = IdleStrategy::RUNTIME;
+  uint64_t spin_ns = 50000;
+
+  // The nice value of the workers, from -20 (highest) to 19. Zero leaves
+  // their priority alone. Raising it needs CAP_SYS_NICE.
+  int priority = 0;
+};
+
 // Holds the game engine state.
 struct Universe {
   void* self;
+
+  // Read by init().
+  ExecutorConfig executor;
 };
 
 }
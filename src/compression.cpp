@@ -0,0 +1,182 @@
+#include "compression.h"
+
+#include <cstring>
+
+// Each sequence is encoded as:
+//   token: [literal length : 4][match length - MIN_MATCH : 4]
+//   extra literal length bytes, if the nibble is 15 (255 means continue)
+//   literals
+//   offset : 16 little-endian
+//   extra match length bytes, if the nibble is 15
+// The last sequence only has literals.
+namespace {
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 0xFFFF;
+const int HASH_BITS = 14;
+
+// The last bytes of a block are always emitted as literals so that the
+// matcher never reads past the end of the input.
+const size_t END_LITERALS = 8;
+
+inline uint32_t read32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+inline uint8_t* write_length(uint8_t* dst, size_t length) {
+  while (length >= 255) {
+    *dst++ = 255;
+    length -= 255;
+  }
+  *dst++ = (uint8_t)length;
+  return dst;
+}
+
+uint8_t* write_sequence(uint8_t* dst, const uint8_t* literals,
+                        size_t literal_length, size_t offset,
+                        size_t match_length) {
+  uint8_t* token = dst++;
+  uint8_t lit_nibble = literal_length < 15 ? literal_length : 15;
+  *token = lit_nibble << 4;
+  if (lit_nibble == 15) {
+    dst = write_length(dst, literal_length - 15);
+  }
+  memcpy(dst, literals, literal_length);
+  dst += literal_length;
+
+  if (match_length == 0) {
+    return dst;
+  }
+
+  *dst++ = (uint8_t)(offset & 0xFF);
+  *dst++ = (uint8_t)(offset >> 8);
+
+  size_t ml = match_length - MIN_MATCH;
+  uint8_t match_nibble = ml < 15 ? ml : 15;
+  *token |= match_nibble;
+  if (match_nibble == 15) {
+    dst = write_length(dst, ml - 15);
+  }
+  return dst;
+}
+
+bool read_length(const uint8_t*& src, const uint8_t* end, size_t* length) {
+  uint8_t b;
+  do {
+    if (src >= end) {
+      return false;
+    }
+    b = *src++;
+    *length += b;
+  } while (b == 255);
+  return true;
+}
+
+}  // namespace
+
+namespace radiance {
+namespace lz {
+
+size_t bound(size_t size) {
+  return size + size / 255 + 16;
+}
+
+size_t compress(const uint8_t* src, size_t size, uint8_t* dst) {
+  uint8_t* out = dst;
+  const uint8_t* anchor = src;
+
+  if (size > END_LITERALS + MIN_MATCH) {
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t* limit = src + size - END_LITERALS;
+    const uint8_t* p = src + 1;
+    while (p < limit) {
+      uint32_t seq = read32(p);
+      uint32_t h = hash(seq);
+      const uint8_t* candidate = src + table[h];
+      table[h] = (uint32_t)(p - src);
+
+      if (candidate >= p || (size_t)(p - candidate) > MAX_OFFSET ||
+          read32(candidate) != seq) {
+        ++p;
+        continue;
+      }
+
+      size_t length = MIN_MATCH;
+      while (p + length < limit && candidate[length] == p[length]) {
+        ++length;
+      }
+
+      out = write_sequence(out, anchor, p - anchor, p - candidate, length);
+      p += length;
+      anchor = p;
+    }
+  }
+
+  out = write_sequence(out, anchor, src + size - anchor, 0, 0);
+  return out - dst;
+}
+
+bool decompress(const uint8_t* src, size_t src_size,
+                uint8_t* dst, size_t dst_size) {
+  const uint8_t* in_end = src + src_size;
+  uint8_t* out = dst;
+  uint8_t* out_end = dst + dst_size;
+
+  while (src < in_end) {
+    uint8_t token = *src++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !read_length(src, in_end, &literal_length)) {
+      return false;
+    }
+    if ((size_t)(in_end - src) < literal_length ||
+        (size_t)(out_end - out) < literal_length) {
+      return false;
+    }
+    memcpy(out, src, literal_length);
+    src += literal_length;
+    out += literal_length;
+
+    // The last sequence has no match.
+    if (src == in_end) {
+      break;
+    }
+
+    if (in_end - src < 2) {
+      return false;
+    }
+    size_t offset = src[0] | (src[1] << 8);
+    src += 2;
+
+    size_t match_length = token & 0xF;
+    if (match_length == 15 && !read_length(src, in_end, &match_length)) {
+      return false;
+    }
+    match_length += MIN_MATCH;
+
+    if (offset == 0 || offset > (size_t)(out - dst) ||
+        (size_t)(out_end - out) < match_length) {
+      return false;
+    }
+
+    // Matches may overlap their own output, so copy byte by byte.
+    const uint8_t* match = out - offset;
+    for (size_t i = 0; i < match_length; ++i) {
+      out[i] = match[i];
+    }
+    out += match_length;
+  }
+
+  return out == out_end;
+}
+
+}  // namespace lz
+}  // namespace radiance
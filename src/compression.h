@@ -0,0 +1,28 @@
+#ifndef COMPRESSION__H
+#define COMPRESSION__H
+
+#include "common.h"
+
+namespace radiance {
+namespace lz {
+
+// A byte-oriented LZ77 block codec in the style of LZ4: a greedy matcher
+// with a small hash table, 16-bit offsets, and no entropy coding. It trades
+// ratio for speed so that snapshots stay bound by the disk.
+
+// Returns the worst case compressed size of a block of size bytes.
+size_t bound(size_t size);
+
+// Compresses size bytes from src into dst, which must hold at least
+// bound(size) bytes. Returns the compressed size.
+size_t compress(const uint8_t* src, size_t size, uint8_t* dst);
+
+// Decompresses a block of src_size bytes into dst, which holds exactly
+// dst_size bytes. Returns false if the block is malformed.
+bool decompress(const uint8_t* src, size_t src_size,
+                uint8_t* dst, size_t dst_size);
+
+}  // namespace lz
+}  // namespace radiance
+
+#endif  // COMPRESSION__H
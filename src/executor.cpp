@@ -0,0 +1,178 @@
+#include "executor.h"
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <omp.h>
+
+namespace {
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void futex_wait(std::atomic<uint32_t>* addr, uint32_t expected) {
+  syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, expected,
+          nullptr, nullptr, 0);
+}
+
+void futex_wake_all(std::atomic<uint32_t>* addr) {
+  syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, INT32_MAX,
+          nullptr, nullptr, 0);
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+}  // namespace
+
+namespace radiance {
+
+std::atomic<uint64_t> Executor::next_id_{1};
+
+Status::Code Executor::configure(const ExecutorConfig& config) {
+  if (config.idle == IdleStrategy::UNKNOWN ||
+      (config.cpu_count > 0 && !config.cpus) ||
+      config.priority < -20 || config.priority > 19) {
+    return Status::FAILED_INITIALIZATION;
+  }
+  for (uint32_t i = 0; i < config.cpu_count; ++i) {
+    if (config.cpus[i] < 0 || config.cpus[i] >= CPU_SETSIZE) {
+      return Status::FAILED_INITIALIZATION;
+    }
+  }
+
+  // Workers keep their old setup until they see the new id.
+  id_ = next_id_++;
+  config_ = config;
+  config_.cpus = nullptr;
+  cpus_.assign(config.cpus, config.cpus + config.cpu_count);
+
+  workers_ = config.workers ? config.workers : omp_get_max_threads();
+  void* slots = aligned_alloc(CACHE_LINE_SIZE,
+                              workers_ * sizeof(CacheAlligned<Slot>));
+  if (!slots) {
+    return Status::FAILED_INITIALIZATION;
+  }
+  memset(slots, 0, workers_ * sizeof(CacheAlligned<Slot>));
+  slots_.reset((CacheAlligned<Slot>*)slots);
+  for (size_t i = 0; i < workers_; ++i) {
+    slots_[i].data.stats.cpu = -1;
+  }
+
+  return apply(0) ? Status::OK : Status::FAILED_INITIALIZATION;
+}
+
+bool Executor::apply(size_t worker) const {
+  if (!cpus_.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus_[worker % cpus_.size()], &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+      return false;
+    }
+  }
+  if (config_.priority != 0 &&
+      setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid),
+                  config_.priority) != 0) {
+    return false;
+  }
+  return true;
+}
+
+void Executor::begin() {
+  arrived_.store(0);
+  parked_.store(false);
+}
+
+void Executor::enter(size_t worker, size_t team) {
+  // OpenMP may hand out a worker number to a different thread than last
+  // time, so each thread remembers which worker it was set up as.
+  thread_local struct {
+    uint64_t owner;
+    size_t worker;
+  } applied = {0, 0};
+  if (applied.owner != id_ || applied.worker != worker) {
+    apply(worker);
+    applied = {id_, worker};
+  }
+
+  if (worker == 0) {
+    team_ = team;
+  }
+  Slot& slot = slots_[worker].data;
+  int cpu = sched_getcpu();
+  if (slot.stats.cpu >= 0 && cpu != slot.stats.cpu) {
+    ++slot.stats.migrations;
+  }
+  slot.stats.cpu = cpu;
+  ++slot.stats.runs;
+  slot.start_ns = now_ns();
+}
+
+void Executor::leave(size_t worker) {
+  Slot& slot = slots_[worker].data;
+  slot.done_ns = now_ns();
+  size_t team = omp_get_num_threads();
+  uint32_t arrived = arrived_.fetch_add(1) + 1;
+  if (config_.idle == IdleStrategy::RUNTIME) {
+    return;
+  }
+  if (arrived == team) {
+    if (parked_.load()) {
+      futex_wake_all(&arrived_);
+    }
+    return;
+  }
+
+  uint64_t spin_ns = 0;
+  if (config_.idle == IdleStrategy::SPIN) {
+    spin_ns = UINT64_MAX;
+  } else if (config_.idle == IdleStrategy::SPIN_THEN_PARK) {
+    spin_ns = config_.spin_ns;
+  }
+
+  // The last worker to arrive only wakes the others if one has parked. The
+  // flag is set before the futex checks arrived_, so one of the two always
+  // sees the other.
+  uint32_t spins = 0;
+  while ((arrived = arrived_.load()) != team) {
+    if ((spin_ns == 0 || ++spins % 64 == 0) &&
+        now_ns() - slot.done_ns >= spin_ns) {
+      parked_.store(true);
+      futex_wait(&arrived_, arrived);
+    } else {
+      cpu_relax();
+    }
+  }
+}
+
+void Executor::end() {
+  uint64_t last = 0;
+  for (size_t i = 0; i < team_; ++i) {
+    last = std::max(last, slots_[i].data.done_ns);
+  }
+  for (size_t i = 0; i < team_; ++i) {
+    Slot& slot = slots_[i].data;
+    slot.stats.busy_ns += slot.done_ns - slot.start_ns;
+    slot.stats.idle_ns += last - slot.done_ns;
+  }
+}
+
+WorkerStats Executor::stats(size_t worker) const {
+  return slots_[worker].data.stats;
+}
+
+}  // namespace radiance
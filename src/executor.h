@@ -0,0 +1,79 @@
+#ifndef EXECUTOR__H
+#define EXECUTOR__H
+
+#include "common.h"
+#include "radiance.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace radiance {
+
+// Sets up the OpenMP threads that run pipelines as the ExecutorConfig asks and
+// keeps their stats. Each run is bracketed like so:
+//
+//   executor->begin();
+//   #pragma omp parallel num_threads(executor->workers())
+//   {
+//     executor->enter(omp_get_thread_num(), omp_get_num_threads());
+//     ...
+//     executor->leave(omp_get_thread_num());
+//   }
+//   executor->end();
+class Executor {
+ public:
+  Executor() : id_(next_id_++) {}
+
+  // Pins the calling thread, as worker 0, to check the config. The other
+  // workers are set up the first time they run.
+  Status::Code configure(const ExecutorConfig& config);
+
+  inline size_t workers() const {
+    return workers_;
+  }
+
+  void begin();
+  void enter(size_t worker, size_t team);
+
+  // Waits for the rest of the team as the IdleStrategy says.
+  void leave(size_t worker);
+  void end();
+
+  WorkerStats stats(size_t worker) const;
+
+ private:
+  struct Slot {
+    uint64_t start_ns;
+    uint64_t done_ns;
+    WorkerStats stats;
+  };
+
+  struct Free {
+    void operator()(void* p) const {
+      free(p);
+    }
+  };
+
+  // Applies the pinning and priority of the config to the calling thread.
+  bool apply(size_t worker) const;
+
+  // Ids start at 1 so that a thread's empty cache never matches.
+  static std::atomic<uint64_t> next_id_;
+
+  uint64_t id_;
+  ExecutorConfig config_;
+  std::vector<int> cpus_;
+  size_t workers_ = 0;
+  size_t team_ = 0;
+  // Cache aligned so that workers never write to the same line.
+  std::unique_ptr<CacheAlligned<Slot>[], Free> slots_;
+
+  std::atomic<uint32_t> arrived_{0};
+  std::atomic<bool> parked_{false};
+};
+
+}  // namespace radiance
+
+#endif  // EXECUTOR__H
@@ -0,0 +1,173 @@
+#include "numa.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+
+const char NODE_DIR[] = "/sys/devices/system/node";
+
+// From linux/mempolicy.h.
+const int MPOL_PREFERRED = 1;
+const unsigned MPOL_MF_MOVE = 1 << 1;
+
+// Parses a sysfs CPU list, e.g. "0-3,8,10-11".
+std::vector<int> parse_cpu_list(const char* list) {
+  std::vector<int> cpus;
+  const char* p = list;
+  while (*p) {
+    char* end;
+    long first = strtol(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back((int)cpu);
+    }
+    if (*p == ',') {
+      ++p;
+    } else {
+      break;
+    }
+  }
+  return cpus;
+}
+
+bool read_line(const std::string& path, char* buf, size_t size) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (!f) {
+    return false;
+  }
+  bool ok = fgets(buf, (int)size, f) != nullptr;
+  fclose(f);
+  return ok;
+}
+
+}  // namespace
+
+namespace radiance {
+namespace numa {
+
+Topology Topology::detect() {
+  Topology t;
+  t.os_node_.push_back(0);
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return t;
+  }
+  t.node_of_cpu_.assign(CPU_SETSIZE, 0);
+
+  const char* fake = getenv("RADIANCE_NUMA_NODES");
+  if (fake && atoi(fake) > 1) {
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+    size_t n = (size_t)atoi(fake);
+    size_t per_node = (cpus.size() + n - 1) / n;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+      t.node_of_cpu_[cpus[i]] = (int)(i / per_node);
+    }
+    t.nodes_ = cpus.empty() ? 1 : (cpus.size() + per_node - 1) / per_node;
+    return t;
+  }
+
+  DIR* dir = opendir(NODE_DIR);
+  if (!dir) {
+    return t;
+  }
+  std::vector<int> os_nodes;
+  while (dirent* entry = readdir(dir)) {
+    int id;
+    char rest;
+    if (sscanf(entry->d_name, "node%d%c", &id, &rest) == 1) {
+      os_nodes.push_back(id);
+    }
+  }
+  closedir(dir);
+  std::sort(os_nodes.begin(), os_nodes.end());
+
+  // Nodes without allowed CPUs are left out.
+  std::vector<int> used;
+  for (int id : os_nodes) {
+    char list[4096];
+    std::string path = std::string(NODE_DIR) + "/node" + std::to_string(id) + "/cpulist";
+    if (!read_line(path, list, sizeof(list))) {
+      continue;
+    }
+    bool any = false;
+    for (int cpu : parse_cpu_list(list)) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+        t.node_of_cpu_[cpu] = (int)used.size();
+        any = true;
+      }
+    }
+    if (any) {
+      used.push_back(id);
+    }
+  }
+
+  if (used.size() > 1) {
+    t.nodes_ = used.size();
+    t.os_node_ = used;
+    t.placeable_ = true;
+  } else {
+    t.node_of_cpu_.assign(CPU_SETSIZE, 0);
+  }
+  return t;
+}
+
+int Topology::current_node() const {
+  if (nodes_ == 1) {
+    return 0;
+  }
+  return node_of_cpu(sched_getcpu());
+}
+
+int Topology::node_of_cpu(int cpu) const {
+  if (cpu < 0 || (size_t)cpu >= node_of_cpu_.size()) {
+    return 0;
+  }
+  return node_of_cpu_[cpu];
+}
+
+bool Topology::place(const void* begin, const void* end, int node) const {
+  if (!placeable_ || node < 0 || (size_t)node >= nodes_) {
+    return false;
+  }
+
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t first = ((uintptr_t)begin + page - 1) & ~(page - 1);
+  uintptr_t last = (uintptr_t)end & ~(page - 1);
+  if (first >= last) {
+    return true;
+  }
+
+  int os_node = os_node_[node];
+  const size_t BITS = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(os_node / BITS + 1, 0);
+  mask[os_node / BITS] |= 1ul << (os_node % BITS);
+  return syscall(SYS_mbind, (void*)first, last - first, MPOL_PREFERRED,
+                 mask.data(), mask.size() * BITS, MPOL_MF_MOVE) == 0;
+}
+
+}  // namespace numa
+}  // namespace radiance
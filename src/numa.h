@@ -0,0 +1,56 @@
+#ifndef NUMA__H
+#define NUMA__H
+
+#include "common.h"
+
+#include <vector>
+
+namespace radiance {
+namespace numa {
+
+// The NUMA nodes that this process may run on, read from sysfs and limited
+// to the CPUs in the process' affinity mask, so that running under numactl
+// shrinks it. Machines without NUMA support look like a single node.
+//
+// Setting RADIANCE_NUMA_NODES=n splits the allowed CPUs into n nodes of
+// consecutive CPUs instead, to try out partitioning on a machine with fewer
+// nodes. Memory is not moved in that case.
+class Topology {
+ public:
+  static Topology detect();
+
+  inline size_t nodes() const {
+    return nodes_;
+  }
+
+  // Whether memory can be moved between the nodes.
+  inline bool placeable() const {
+    return placeable_;
+  }
+
+  // The node of the CPU the calling thread is running on.
+  int current_node() const;
+
+  int node_of_cpu(int cpu) const;
+
+  // Moves the pages that [begin, end) lies in to node and prefers the node
+  // for them from then on. Partial pages at either end are left alone.
+  // Returns false if nothing could be moved, e.g. on a single node or when
+  // the kernel does not allow it.
+  bool place(const void* begin, const void* end, int node) const;
+
+ private:
+  size_t nodes_ = 1;
+  bool placeable_ = false;
+
+  // Indexed by CPU. CPUs that are not allowed map to node 0.
+  std::vector<int> node_of_cpu_;
+
+  // The kernel's number for each node.
+  std::vector<int> os_node_;
+};
+
+}  // namespace numa
+}  // namespace radiance
+
+#endif  // NUMA__H
@@ -1,4 +1,6 @@
 #include "private_universe.h"
+#include "snapshot.h"
+#include "spans.h"
 
 #include <algorithm>
 
@@ -6,14 +8,37 @@ namespace {
   std::string form_path(const char* program, const char* resource) {
     return std::string{program} + radiance::NAMESPACE_DELIMETER + std::string{resource};
   }
+
+  // A fast, non-cryptographic hash that consumes 8 bytes at a time.
+  uint64_t hash_bytes(uint64_t h, const uint8_t* data, uint64_t size) {
+    const uint64_t PRIME = 0x100000001b3;
+    uint64_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, data + i, sizeof(uint64_t));
+      h = (h ^ word) * PRIME;
+      h ^= h >> 29;
+    }
+    for (; i < size; ++i) {
+      h = (h ^ data[i]) * PRIME;
+    }
+    return h;
+  }
 }  // namespace
 
 namespace radiance {
 
+std::atomic<uint64_t> ScratchRegistry::next_id_{1};
+
 PrivateUniverse::PrivateUniverse():
-    run_state_(RunState::STOPPED) {}
+    topology_(numa::Topology::detect()),
+    run_state_(RunState::STOPPED),
+    reorder_budget_ns_(0),
+    execution_mode_(ExecutionMode::FAST) {}
 
-PrivateUniverse::~PrivateUniverse() {}
+PrivateUniverse::~PrivateUniverse() {
+  join_async();
+}
 
 Status::Code PrivateUniverse::transition(
     RunState allowed, RunState next) {
@@ -30,7 +55,11 @@ Status::Code PrivateUniverse::transition(
   return Status::BAD_RUN_STATE;
 }
 
-Status::Code PrivateUniverse::init() {
+Status::Code PrivateUniverse::init(const ExecutorConfig& config) {
+  Status::Code status = executor_.configure(config);
+  if (status != Status::OK) {
+    return status;
+  }
   return transition(RunState::STOPPED, RunState::INITIALIZED);
 }
 
@@ -39,13 +68,128 @@ Status::Code PrivateUniverse::start() {
 }
 
 Status::Code PrivateUniverse::loop() {
+  std::chrono::steady_clock::time_point start = begin_frame();
+  run_frame(start, &frame_stats_);
+  return end_frame(start);
+}
+
+std::chrono::steady_clock::time_point PrivateUniverse::begin_frame() {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  frame_stats_.ingested += collections_.merge();
+  collections_.prepare();
+  return start;
+}
+
+void PrivateUniverse::run_frame(std::chrono::steady_clock::time_point start,
+                                FrameStats* stats) {
+  typedef std::chrono::steady_clock Clock;
+  RunContext context{execution_mode_, &scratch_, &topology_, &executor_,
+                     Clock::time_point::max(), critical_priority_};
+  if (frame_budget_ns_) {
+    context.deadline = start + std::chrono::nanoseconds(frame_budget_ns_);
+  }
   ProgramImpl* p = (ProgramImpl*)programs_.get_program("main")->self;
-  p->run();
+  p->run(context, stats);
+}
+
+Status::Code PrivateUniverse::end_frame(
+    std::chrono::steady_clock::time_point start) {
+  typedef std::chrono::steady_clock Clock;
+  jobs_.run();
+  frame_stats_.published += collections_.publish();
+
+  uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now() - start).count();
+  ++frame_stats_.frames;
+  frame_stats_.last_frame_ns = elapsed;
+  if (frame_budget_ns_ && elapsed > frame_budget_ns_) {
+    ++frame_stats_.over_budget;
+  }
+
+  collections_.reorder(reorder_budget_ns_);
+  collections_.shrink();
+  scratch_.reset();
 
   return transition({RunState::RUNNING, RunState::STARTED}, RunState::RUNNING);
 }
 
+Fence PrivateUniverse::loop_async() {
+  std::unique_lock<std::mutex> lock(async_mutex_);
+  async_cv_.wait(lock, [this] { return finished_ == started_; });
+  if (async_status_ != Status::OK) {
+    return 0;
+  }
+  views_.publish();
+  if (!async_thread_.joinable()) {
+    async_thread_ = std::thread(&PrivateUniverse::run_async, this);
+  }
+  Fence fence = ++started_;
+  async_cv_.notify_all();
+  return fence;
+}
+
+Status::Code PrivateUniverse::wait_frame(Fence fence) {
+  std::unique_lock<std::mutex> lock(async_mutex_);
+  if (fence == 0 || fence > started_) {
+    return Status::DOES_NOT_EXIST;
+  }
+  async_cv_.wait(lock, [this, fence] { return finished_ >= fence; });
+
+  // A later frame may still be capturing into the back buffers, so the
+  // views only move on when waiting on the last frame started.
+  if (fence == started_) {
+    views_.publish();
+  }
+
+  // No frame starts after one fails, so earlier frames succeeded.
+  return fence == finished_ ? async_status_ : Status::OK;
+}
+
+void PrivateUniverse::run_async() {
+  std::unique_lock<std::mutex> lock(async_mutex_);
+  while (true) {
+    async_cv_.wait(lock, [this] { return quit_ || started_ > finished_; });
+    if (started_ == finished_) {
+      return;
+    }
+    Fence fence = started_;
+    lock.unlock();
+    Status::Code status = loop();
+    if (status == Status::OK) {
+      views_.capture(fence);
+    }
+    lock.lock();
+    async_status_ = status;
+    finished_ = fence;
+    async_cv_.notify_all();
+  }
+}
+
+void PrivateUniverse::join_async() {
+  if (!async_thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(async_mutex_);
+    quit_ = true;
+  }
+  async_cv_.notify_all();
+  async_thread_.join();
+  async_thread_ = std::thread();
+  quit_ = false;
+}
+
+Status::Code PrivateUniverse::watch_collection(Collection* collection) {
+  return views_.watch(collection);
+}
+
+Status::Code PrivateUniverse::read_view(Collection* collection, ReadView* view) {
+  return views_.read(collection, view);
+}
+
 Status::Code PrivateUniverse::stop() {
+  join_async();
   return transition({RunState::RUNNING, RunState::UNKNOWN}, RunState::STOPPED);
 }
 
@@ -66,6 +210,14 @@ struct Pipeline* PrivateUniverse::add_pipeline(
   return programs_.to_impl(p)->add_pipeline(src, snk);
 }
 
+struct Job* PrivateUniverse::add_job() {
+  return jobs_.add();
+}
+
+Status::Code PrivateUniverse::remove_job(struct Job* job) {
+  return jobs_.remove(job);
+}
+
 Status::Code PrivateUniverse::remove_pipeline(struct Pipeline* pipeline) {
   ASSERT_NOT_NULL(pipeline);
 
@@ -134,4 +286,151 @@ Status::Code PrivateUniverse::copy_collection(const char*, const char*) {
   return Status::OK;
 }
 
+Status::Code PrivateUniverse::set_reorder_budget(uint64_t budget_ns) {
+  reorder_budget_ns_ = budget_ns;
+  return Status::OK;
+}
+
+Status::Code PrivateUniverse::set_execution_mode(ExecutionMode mode) {
+  if (mode != ExecutionMode::FAST && mode != ExecutionMode::DETERMINISTIC) {
+    return Status::UNKNOWN;
+  }
+  execution_mode_ = mode;
+  return Status::OK;
+}
+
+Status::Code PrivateUniverse::set_frame_budget(uint64_t budget_ns,
+                                               int16_t critical_priority) {
+  frame_budget_ns_ = budget_ns;
+  critical_priority_ = critical_priority;
+  return Status::OK;
+}
+
+FrameStats PrivateUniverse::frame_stats() {
+  return frame_stats_;
+}
+
+Status::Code PrivateUniverse::shrink_collection(Collection* collection) {
+  ASSERT_NOT_NULL(collection);
+  if (!collection->shrink) {
+    return Status::NULL_POINTER;
+  }
+  collections_.request_shrink(collection);
+  return Status::OK;
+}
+
+ScratchStats PrivateUniverse::scratch_stats() {
+  return scratch_.stats();
+}
+
+uint64_t PrivateUniverse::numa_nodes() {
+  return topology_.nodes();
+}
+
+uint64_t PrivateUniverse::worker_count() {
+  return executor_.workers();
+}
+
+Status::Code PrivateUniverse::worker_stats(uint64_t worker, WorkerStats* stats) {
+  ASSERT_NOT_NULL(stats);
+  if (worker >= executor_.workers()) {
+    return Status::DOES_NOT_EXIST;
+  }
+  *stats = executor_.stats(worker);
+  return Status::OK;
+}
+
+uint64_t PrivateUniverse::hash_collections() {
+  uint64_t h = 0xcbf29ce484222325;
+  for (auto& named : collections_.all()) {
+    Collection* c = named.second;
+    uint64_t count = c->count ? c->count(c) : 0;
+    h = hash_bytes(h, (const uint8_t*)named.first.data(), named.first.size());
+    h = hash_bytes(h, (const uint8_t*)&count, sizeof(count));
+    for_each_span(c, count, [&](const uint8_t* keys, const uint8_t* values,
+                                uint64_t n) {
+      h = hash_bytes(h, keys, n * c->keys.size);
+      h = hash_bytes(h, values, n * c->values.size);
+    });
+  }
+  return h;
+}
+
+Status::Code PrivateUniverse::verify_loop() {
+  struct Saved {
+    Collection* collection;
+    uint64_t count;
+    std::vector<uint8_t> keys;
+    std::vector<uint8_t> values;
+  };
+
+  // Empty collections are saved too, so that the rows the first run inserts
+  // into them are rolled back.
+  for (auto& named : collections_.all()) {
+    Collection* c = named.second;
+    if (c->count && !c->load) {
+      return Status::NULL_POINTER;
+    }
+  }
+
+  // Only the pipelines run twice. The ingested mutations are merged before
+  // and the jobs run after, once, as in a single loop().
+  std::chrono::steady_clock::time_point start = begin_frame();
+
+  std::vector<Saved> saved;
+  for (auto& named : collections_.all()) {
+    Collection* c = named.second;
+    if (!c->count) {
+      continue;
+    }
+    uint64_t count = c->count(c);
+    saved.push_back({c, count, {}, {}});
+    gather(c, count, &saved.back().keys, &saved.back().values);
+  }
+  ProgramImpl* p = (ProgramImpl*)programs_.get_program("main")->self;
+  std::vector<PipelineImpl::Deferred> deferred = p->deferred();
+
+  // The frame budget is time boxed, so it would make the runs stop at
+  // different rows. The pipelines still carry on from where the last frame
+  // left off.
+  uint64_t frame_budget_ns = frame_budget_ns_;
+  frame_budget_ns_ = 0;
+
+  FrameStats stats = frame_stats_;
+  run_frame(start, &stats);
+  uint64_t first = hash_collections();
+  for (Saved& s : saved) {
+    s.collection->load(s.collection, s.keys.data(), s.values.data(), s.count);
+  }
+  p->restore(deferred);
+  run_frame(start, &frame_stats_);
+  uint64_t second = hash_collections();
+
+  frame_budget_ns_ = frame_budget_ns;
+  Status::Code status = end_frame(start);
+  if (status != Status::OK) {
+    return status;
+  }
+  return first == second ? Status::OK : Status::NONDETERMINISTIC;
+}
+
+Status::Code PrivateUniverse::save_snapshot(const char* path, Compression compression) {
+  std::vector<snapshot::NamedCollection> collections;
+  for (auto& named : collections_.all()) {
+    collections.push_back({named.first, named.second});
+  }
+  return snapshot::save(path, compression, programs_.names(), collections);
+}
+
+Status::Code PrivateUniverse::load_snapshot(const char* path) {
+  return snapshot::load(
+      path,
+      [this](const std::string& program) {
+        programs_.create_program(program.data());
+      },
+      [this](const std::string& collection) {
+        return collections_.get(collection.data());
+      });
+}
+
 }  // namespace radiance
@@ -4,15 +4,27 @@
 #include "radiance.h"
 #include "table.h"
 #include "stack_memory.h"
+#include "executor.h"
+#include "numa.h"
+#include "spans.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstring>
 #include <limits>
+#include <memory>
+#include <new>
 #include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include <omp.h>
 
 #define LOG_VAR(var) std::cout << #var << " = " << var << std::endl
 
@@ -41,10 +53,82 @@ class CollectionRegistry {
       Handle id = collections_.insert(name, nullptr);
       ret = new_collection(id, collection);
       collections_[id] = ret;
+      unique_.push_back(ret);
     }
     return ret;
   }
 
+  uint64_t merge() {
+    uint64_t count = 0;
+    for (Collection* c : unique_) {
+      if (c->merge) {
+        count += c->merge(c);
+      }
+    }
+    return count;
+  }
+
+  uint64_t publish() {
+    uint64_t count = 0;
+    for (Collection* c : unique_) {
+      if (c->publish) {
+        count += c->publish(c);
+      }
+    }
+    return count;
+  }
+
+  void prepare() {
+    for (Collection* c : unique_) {
+      if (c->prepare) {
+        c->prepare(c);
+      }
+    }
+  }
+
+  // Gives each reorderable collection a turn until the budget is spent. The
+  // starting collection rotates so that no collection is starved.
+  void reorder(uint64_t budget_ns) {
+    typedef std::chrono::steady_clock Clock;
+    if (budget_ns == 0 || unique_.empty()) {
+      return;
+    }
+
+    Clock::time_point deadline = Clock::now() + std::chrono::nanoseconds(budget_ns);
+    size_t count = unique_.size();
+    size_t start = next_reorder_++ % count;
+    for (size_t i = 0; i < count; ++i) {
+      Collection* c = unique_[(start + i) % count];
+      if (!c->reorder) {
+        continue;
+      }
+
+      Clock::time_point now = Clock::now();
+      if (now >= deadline) {
+        break;
+      }
+      c->reorder(c, std::chrono::duration_cast<std::chrono::nanoseconds>(
+          deadline - now).count());
+    }
+  }
+
+  // Shrinking may move a collection's storage, so requests are held until
+  // the end of the frame. Requests may come from any thread.
+  void request_shrink(Collection* c) {
+    std::lock_guard<std::mutex> lock(shrink_mutex_);
+    if (std::find(shrink_.begin(), shrink_.end(), c) == shrink_.end()) {
+      shrink_.push_back(c);
+    }
+  }
+
+  void shrink() {
+    std::lock_guard<std::mutex> lock(shrink_mutex_);
+    for (Collection* c : shrink_) {
+      c->shrink(c);
+    }
+    shrink_.clear();
+  }
+
   Status::Code share(const char* source, const char* dest) {
     Handle src = collections_.find(source);
     Handle dst = collections_.find(dest);
@@ -69,6 +153,20 @@ class CollectionRegistry {
     return get(name.data());
   }
 
+  // Every collection once, under the name it was added with.
+  std::vector<std::pair<std::string, Collection*>> all() const {
+    std::vector<std::pair<std::string, Collection*>> ret;
+    for (Collection* c : unique_) {
+      for (uint64_t i = 0; i < collections_.size(); ++i) {
+        if (collections_.values[i] == c) {
+          ret.push_back({collections_.keys[i], c});
+          break;
+        }
+      }
+    }
+    return ret;
+  }
+
   inline static CollectionImpl* to_impl(Collection* c) {
     return (CollectionImpl*)c->self;
   }
@@ -84,14 +182,302 @@ class CollectionRegistry {
   }
 
   Table<std::string, Collection*> collections_;
+
+  // Every collection once, regardless of how many names it is shared under.
+  std::vector<Collection*> unique_;
+  uint64_t next_reorder_ = 0;
+
+  std::mutex shrink_mutex_;
+  std::vector<Collection*> shrink_;
+};
+
+// The Stack each thread transforms elements on. Stacks are created on a
+// thread's first use and reset between frames, which releases what they grew
+// into during the frame.
+class ScratchRegistry {
+ public:
+  ScratchRegistry() : id_(next_id_++) {}
+
+  Stack* local() {
+    // Cached per thread, so only a thread's first call takes the lock. A
+    // thread that alternates between registries finds its Stack again by its
+    // id rather than being given a new one.
+    thread_local struct {
+      uint64_t owner;
+      Stack* stack;
+    } cached = {0, nullptr};
+    if (cached.owner != id_) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::unique_ptr<Stack>& stack = stacks_[std::this_thread::get_id()];
+      if (!stack) {
+        stack.reset(new Stack());
+      }
+      cached = {id_, stack.get()};
+    }
+    return cached.stack;
+  }
+
+  // Only call between frames, while no thread is using its Stack.
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& stack : stacks_) {
+      stack.second->reset();
+    }
+  }
+
+  ScratchStats stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScratchStats ret = {};
+    ret.threads = stacks_.size();
+    for (auto& stack : stacks_) {
+      const Arena::Stats& s = stack.second->stats();
+      ret.capacity += s.capacity;
+      ret.high_water = std::max(ret.high_water, s.high_water);
+      ret.frame_high_water = std::max(ret.frame_high_water, s.frame_high_water);
+      ret.chunk_allocations += s.chunk_allocations;
+    }
+    return ret;
+  }
+
+ private:
+  // Ids start at 1 so that a thread's empty cache never matches.
+  static std::atomic<uint64_t> next_id_;
+
+  const uint64_t id_;
+  std::mutex mutex_;
+  std::unordered_map<std::thread::id, std::unique_ptr<Stack>> stacks_;
+};
+
+// Double-buffered copies of the watched collections. The thread running
+// frames captures into the back buffers while the caller reads the front.
+class ReadViews {
+ public:
+  Status::Code watch(Collection* collection) {
+    ASSERT_NOT_NULL(collection);
+    if (!collection->count) {
+      return Status::NULL_POINTER;
+    }
+    views_[collection];
+    return Status::OK;
+  }
+
+  // Copies every watched collection into the back buffers.
+  void capture(uint64_t frame) {
+    size_t back = front_ ^ 1;
+    for (auto& view : views_) {
+      Collection* c = view.first;
+      Buffers& buffers = view.second;
+      buffers.count[back] = c->count(c);
+      gather(c, buffers.count[back], &buffers.keys[back], &buffers.values[back]);
+    }
+    frame_[back] = frame;
+  }
+
+  // Swaps in the back buffers if they hold a newer frame.
+  void publish() {
+    if (frame_[front_ ^ 1] > frame_[front_]) {
+      front_ ^= 1;
+    }
+  }
+
+  Status::Code read(Collection* collection, ReadView* view) const {
+    ASSERT_NOT_NULL(view);
+    auto found = views_.find(collection);
+    if (found == views_.end()) {
+      return Status::DOES_NOT_EXIST;
+    }
+    const Buffers& buffers = found->second;
+    view->frame = frame_[front_];
+    view->count = buffers.count[front_];
+    view->keys = buffers.keys[front_].data();
+    view->values = buffers.values[front_].data();
+    return Status::OK;
+  }
+
+ private:
+  struct Buffers {
+    uint64_t count[2] = {0, 0};
+    std::vector<uint8_t> keys[2];
+    std::vector<uint8_t> values[2];
+  };
+
+  std::unordered_map<Collection*, Buffers> views_;
+  size_t front_ = 0;
+  uint64_t frame_[2] = {0, 0};
+};
+
+class JobRegistry {
+ public:
+  ~JobRegistry() {
+    for (Job* job : jobs_) {
+      release(job);
+    }
+  }
+
+  Job* add() {
+    Job* job = new (malloc(sizeof(Job))) Job{next_id_++, nullptr, nullptr,
+                                              nullptr, 0};
+    jobs_.push_back(job);
+    return job;
+  }
+
+  Status::Code remove(Job* job) {
+    ASSERT_NOT_NULL(job);
+    auto found = std::find(jobs_.begin(), jobs_.end(), job);
+    if (found == jobs_.end()) {
+      return Status::DOES_NOT_EXIST;
+    }
+    jobs_.erase(found);
+    release(job);
+    return Status::OK;
+  }
+
+  // Resumes every job once, in the order they were added.
+  void run() {
+    // Jobs added by a job start in the next frame.
+    size_t count = jobs_.size();
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+      Job* job = jobs_[i];
+      if (job->resume && job->resume(job, job->budget_ns)) {
+        release(job);
+      } else {
+        jobs_[kept++] = job;
+      }
+    }
+    jobs_.erase(jobs_.begin() + kept, jobs_.begin() + count);
+  }
+
+ private:
+  void release(Job* job) {
+    if (job->release) {
+      job->release(job);
+    }
+    free(job);
+  }
+
+  Id next_id_ = 0;
+  std::vector<Job*> jobs_;
+};
+
+// What a pipeline run needs from the universe.
+struct RunContext {
+  ExecutionMode mode;
+  ScratchRegistry* scratch;
+  const numa::Topology* topology;
+  Executor* executor;
+
+  // Pipelines below critical_priority stop once this has passed and carry on
+  // from there in the next frame.
+  std::chrono::steady_clock::time_point deadline;
+  int16_t critical_priority;
 };
 
 class PipelineImpl {
  private:
+  // Rows are passed through the select predicate this many at a time.
+  static const uint64_t SELECT_BATCH_SIZE = 1024;
+
+  // Rows per piece of work for collections stored in one array.
+  static const uint64_t PIECE_SIZE = 1024;
+
+  // Pieces per thread that a run with a deadline does between checking the
+  // time.
+  static const uint64_t ROUND_PIECES = 4;
+
+  // Part of a selection that is run by one thread, selection[first, first +
+  // count). Without a row selection a piece never crosses a span.
+  struct Piece {
+    uint64_t first;
+    uint64_t count;
+  };
+
+  // Header of a mutation copied off of a Stack. The Mutation and its element
+  // follow it, padded to keep the next header aligned.
+  struct alignas(std::max_align_t) StagedMutation {
+    uint64_t size;
+    uint64_t element_offset;
+  };
+
+  // Grows but never shrinks, so that steady state frames do not allocate.
+  struct StagingBuffer {
+    std::vector<uint8_t> data;
+    size_t size = 0;
+  };
+
+  static void stage(StagingBuffer* buffer, const uint8_t* top, size_t size) {
+    const Mutation* m = (const Mutation*)top;
+    DEBUG_ASSERT(m->element >= top && m->element < top + size,
+                 Status::Code::MEMORY_OUT_OF_BOUNDS);
+
+    uint64_t padded = (size + alignof(StagedMutation) - 1) &
+        ~(alignof(StagedMutation) - 1);
+    size_t at = buffer->size;
+    buffer->size += sizeof(StagedMutation) + padded;
+    if (buffer->size > buffer->data.size()) {
+      buffer->data.resize(std::max(buffer->size, 2 * buffer->data.size()));
+    }
+
+    StagedMutation* staged = (StagedMutation*)(buffer->data.data() + at);
+    staged->size = padded;
+    staged->element_offset = m->element - top;
+    memcpy(staged + 1, top, size);
+  }
+
   Pipeline* pipeline_;
+  RunContext context_ = {};
+  int16_t priority_ = 0;
+
+  // The row of the selection to carry on from after running out of time.
+  uint64_t resume_ = 0;
   std::vector<Collection*> sources_;
   std::vector<Collection*> sinks_;
 
+  // Per thread staging buffers for deterministic runs.
+  std::vector<StagingBuffer> staging_;
+
+  // The partial results of a reduction, one per lane. Each partial starts on
+  // its own cache line so that no two workers write to the same line.
+  typedef CacheAlligned<uint8_t[CACHE_LINE_SIZE]> Line;
+  struct Free {
+    void operator()(void* p) const {
+      free(p);
+    }
+  };
+  std::unique_ptr<Line[], Free> partials_;
+  size_t partial_lines_ = 0;
+  size_t partial_count_ = 0;
+
+  // The rows of the source each lane keeps in a compaction, in row order,
+  // where each lane's rows start in the output, and the output's raw keys
+  // and values. Lanes append to their rows at the same time, so they are
+  // padded apart.
+  struct Kept {
+    std::vector<uint64_t> rows;
+    uint8_t padding[CACHE_LINE_SIZE];
+  };
+  std::vector<Kept> kept_;
+  std::vector<uint64_t> kept_offsets_;
+  std::vector<uint8_t> kept_keys_;
+  std::vector<uint8_t> kept_values_;
+
+  std::vector<Piece> pieces_;
+
+  // The range of pieces each thread runs, by its position in row order.
+  std::vector<size_t> lane_of_thread_;
+  std::vector<int> node_of_thread_;
+
+  // Where the source's rows were last moved to, so that they are only moved
+  // again when the layout changes.
+  struct Placement {
+    Collection* source = nullptr;
+    uint8_t* keys = nullptr;
+    uint8_t* values = nullptr;
+    uint64_t count = 0;
+    std::vector<int> node_of_lane;
+  };
+  Placement placement_;
+
  public:
   PipelineImpl(Pipeline* pipeline) : pipeline_(pipeline) {}
   
@@ -111,47 +497,583 @@ class PipelineImpl {
     }
   }
 
-  void run() {
+  int16_t priority() const {
+    return priority_;
+  }
+
+  void set_priority(int16_t priority) {
+    priority_ = priority;
+  }
+
+  // What a run cut short by the deadline leaves for the next run: the row
+  // to resume from and the partial results of a reduction.
+  struct Deferred {
+    uint64_t resume;
+    std::vector<uint8_t> partials;
+  };
+
+  Deferred deferred() const {
+    Deferred ret{resume_, {}};
+    if (resume_ != 0 && partials_) {
+      const uint8_t* begin = (const uint8_t*)partials_.get();
+      ret.partials.assign(
+          begin, begin + partial_lines_ * partial_count_ * sizeof(Line));
+    }
+    return ret;
+  }
+
+  void restore(const Deferred& deferred) {
+    resume_ = deferred.resume;
+    if (!deferred.partials.empty() &&
+        deferred.partials.size() ==
+            partial_lines_ * partial_count_ * sizeof(Line)) {
+      memcpy(partials_.get(), deferred.partials.data(),
+             deferred.partials.size());
+    }
+  }
+
+  // A compacting pipeline copies raw rows through its sink's load hook, so
+  // the sink needs one and rows of the same shape as the source's.
+  bool compatible() const {
+    if (!pipeline_->compact || pipeline_->reduce.accumulate ||
+        sources_.size() != 1 || sinks_.size() != 1) {
+      return true;
+    }
+    const Collection* source = sources_[0];
+    const Collection* sink = sinks_[0];
+    return sink->load && sink->keys.size == source->keys.size &&
+        sink->values.size == source->values.size;
+  }
+
+  // Returns false if the run stopped at the deadline before all rows were
+  // done.
+  bool run(const RunContext& context) {
+    context_ = context;
     size_t source_size = sources_.size();
     size_t sink_size = sinks_.size();
-    if (source_size == 1 && sink_size == 1) {
-      run_1_to_1();
+    if (pipeline_->reduce.accumulate) {
+      if (source_size == 1 && sink_size == 1) {
+        return run_reduce();
+      }
+    } else if (pipeline_->compact) {
+      if (source_size == 1 && sink_size == 1) {
+        return run_compact();
+      }
+    } else if (source_size == 1 && sink_size == 1) {
+      if (context.mode == ExecutionMode::DETERMINISTIC) {
+        return run_1_to_1_deterministic();
+      }
+      return run_1_to_1();
     } else if (source_size == 1 && sink_size == 0) {
-      run_1_to_0();
+      return run_1_to_0();
     }
+    return true;
   }
 
-  void run_1_to_0() {
+  // Every row of source, or the rows picked by the select_rows hook.
+  Selection select_rows(Collection* source) {
+    Selection selection{source->count(source), nullptr};
+    if (pipeline_->select_rows) {
+      pipeline_->select_rows(pipeline_, source, &selection);
+    }
+    return selection;
+  }
+
+  // Finds the span of a collection that holds a row. A collection without a
+  // span hook is a single span.
+  struct Cursor {
+    Collection* c;
+    Span span;
+
+    Cursor(Collection* c) : c(c) {
+      if (c->span) {
+        span = Span{0, 0, nullptr, nullptr};
+      } else {
+        span = Span{0, std::numeric_limits<uint64_t>::max(),
+                    c->keys.data + c->keys.offset,
+                    c->values.data + c->values.offset};
+      }
+    }
+
+    inline void seek(uint64_t row) {
+      if (row - span.first >= span.count) {
+        c->span(c, row, &span);
+      }
+    }
+
+    inline uint8_t* key(uint64_t row) const {
+      return span.keys + (row - span.first) * c->keys.size;
+    }
+
+    inline uint8_t* value(uint64_t row) const {
+      return span.values + (row - span.first) * c->values.size;
+    }
+  };
+
+  void split(Collection* source, const Selection& selection) {
+    pieces_.clear();
+    if (selection.rows || !source->span) {
+      for (uint64_t first = 0; first < selection.count; first += PIECE_SIZE) {
+        uint64_t count = selection.count - first;
+        pieces_.push_back({first, count < PIECE_SIZE ? count : PIECE_SIZE});
+      }
+      return;
+    }
+
+    for (uint64_t row = 0; row < selection.count;) {
+      Span span;
+      source->span(source, row, &span);
+      if (span.count == 0) {
+        break;
+      }
+      uint64_t end = std::min(span.first + span.count, selection.count);
+      pieces_.push_back({row, end - row});
+      row = end;
+    }
+  }
+
+  // Evaluates the select predicate over selection[begin, end) and writes the
+  // rows it accepts to rows. Runs of consecutive rows within a span are
+  // handed to the predicate in one call so that it can be vectorized.
+  // Returns the number of rows written.
+  uint64_t select_batch(Cursor* cursor, const Selection& selection,
+                        uint64_t begin, uint64_t end,
+                        uint64_t* rows, uint8_t* selected) {
+    uint64_t count = end - begin;
+
+    if (selection.rows) {
+      const uint64_t* r = selection.rows + begin;
+      for (uint64_t i = 0; i < count;) {
+        cursor->seek(r[i]);
+        uint64_t span_end = cursor->span.first + cursor->span.count;
+        uint64_t j = i + 1;
+        while (j < count && r[j] == r[j - 1] + 1 && r[j] < span_end) {
+          ++j;
+        }
+        pipeline_->select(cursor->value(r[i]), j - i, selected + i);
+        i = j;
+      }
+      return compact(r, count, selected, rows);
+    }
+
+    cursor->seek(begin);
+    pipeline_->select(cursor->value(begin), count, selected);
+    return compact(begin, count, selected, rows);
+  }
+
+  // Writes from[i] to rows for every selected[i] that is set, without
+  // branching on selected. Sparse selections skip 8 rows at a time. From is
+  // either an array of rows or the first of a range of rows.
+  template<typename Rows_>
+  static uint64_t compact(Rows_ from, uint64_t count, const uint8_t* selected,
+                          uint64_t* rows) {
+    uint64_t n = 0;
+    uint64_t i = 0;
+    for (; i + sizeof(uint64_t) <= count; i += sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, selected + i, sizeof(uint64_t));
+      if (word == 0) {
+        continue;
+      }
+      for (uint64_t k = i; k < i + sizeof(uint64_t); ++k) {
+        rows[n] = row_at(from, k);
+        n += selected[k] != 0;
+      }
+    }
+    for (; i < count; ++i) {
+      rows[n] = row_at(from, i);
+      n += selected[i] != 0;
+    }
+    return n;
+  }
+
+  static inline uint64_t row_at(const uint64_t* rows, uint64_t i) {
+    return rows[i];
+  }
+
+  static inline uint64_t row_at(uint64_t first, uint64_t i) {
+    return first + i;
+  }
+
+  template<typename Function_>
+  void run_piece(Collection* source, const Selection& selection,
+                 const Piece& piece, const Function_& f) {
+    Cursor cursor(source);
+    uint64_t end = piece.first + piece.count;
+
+    if (!pipeline_->select) {
+      for (uint64_t i = piece.first; i < end; ++i) {
+        uint64_t row = selection.rows ? selection.rows[i] : i;
+        cursor.seek(row);
+        f(row, cursor.key(row), cursor.value(row));
+      }
+      return;
+    }
+
+    uint64_t rows[SELECT_BATCH_SIZE];
+    uint8_t selected[SELECT_BATCH_SIZE];
+    for (uint64_t begin = piece.first; begin < end; begin += SELECT_BATCH_SIZE) {
+      uint64_t n = select_batch(&cursor, selection, begin,
+                                std::min(begin + SELECT_BATCH_SIZE, end),
+                                rows, selected);
+      for (uint64_t i = 0; i < n; ++i) {
+        cursor.seek(rows[i]);
+        f(rows[i], cursor.key(rows[i]), cursor.value(rows[i]));
+      }
+    }
+  }
+
+  // Orders the threads by the NUMA node they run on, so that each node runs
+  // one contiguous range of pieces, and moves the rows of each thread's range
+  // to its node when all pieces are run at once.
+  void assign_lanes(Collection* source, const Selection& selection,
+                    size_t first, size_t last, size_t threads) {
+    std::vector<size_t> order(threads);
+    for (size_t t = 0; t < threads; ++t) {
+      order[t] = t;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+      return node_of_thread_[a] < node_of_thread_[b];
+    });
+
+    std::vector<int> node_of_lane(threads);
+    for (size_t lane = 0; lane < threads; ++lane) {
+      lane_of_thread_[order[lane]] = lane;
+      node_of_lane[lane] = node_of_thread_[order[lane]];
+    }
+
+    // Rows picked by select_rows are scattered, so they are left in place.
+    const numa::Topology* topology = context_.topology;
+    if (!topology->placeable() || selection.rows || first != 0 ||
+        last != pieces_.size()) {
+      return;
+    }
+    if (placement_.source == source && placement_.keys == source->keys.data &&
+        placement_.values == source->values.data &&
+        placement_.count == selection.count &&
+        placement_.node_of_lane == node_of_lane) {
+      return;
+    }
+
+    for (size_t lane = 0; lane < threads; ++lane) {
+      size_t begin = pieces_.size() * lane / threads;
+      size_t end = pieces_.size() * (lane + 1) / threads;
+      if (begin == end) {
+        continue;
+      }
+      uint64_t first = pieces_[begin].first;
+      uint64_t last = pieces_[end - 1].first + pieces_[end - 1].count;
+      for (uint64_t row = first; row < last;) {
+        Cursor cursor(source);
+        cursor.seek(row);
+        uint64_t n = std::min(cursor.span.first + cursor.span.count, last) - row;
+        topology->place(cursor.key(row), cursor.key(row + n), node_of_lane[lane]);
+        topology->place(cursor.value(row), cursor.value(row + n), node_of_lane[lane]);
+        row += n;
+      }
+    }
+    placement_ = Placement{source, source->keys.data, source->values.data,
+                           selection.count, std::move(node_of_lane)};
+  }
+
+  // Runs pieces [first, last) in parallel. Each thread is given one
+  // contiguous range of them, visited in order. Ranges are given out in
+  // thread order, or by node on a NUMA machine, see assign_lanes().
+  // Every thread of the team calls finish(thread, threads) once it has run
+  // its pieces.
+  template<typename Function_, typename Finish_>
+  void run_pieces(Collection* source, const Selection& selection,
+                  size_t first, size_t last, const Function_& f,
+                  const Finish_& finish) {
+    Executor* executor = context_.executor;
+    lane_of_thread_.resize(executor->workers());
+    node_of_thread_.resize(executor->workers());
+    bool numa = context_.topology->nodes() > 1;
+
+    executor->begin();
+#pragma omp parallel num_threads(executor->workers())
+    {
+      size_t thread = omp_get_thread_num();
+      size_t threads = omp_get_num_threads();
+      executor->enter(thread, threads);
+      if (numa) {
+        node_of_thread_[thread] = context_.topology->current_node();
+#pragma omp barrier
+#pragma omp single
+        assign_lanes(source, selection, first, last, threads);
+      } else {
+        lane_of_thread_[thread] = thread;
+      }
+
+      size_t lane = lane_of_thread_[thread];
+      size_t begin = first + (last - first) * lane / threads;
+      size_t end = first + (last - first) * (lane + 1) / threads;
+      for (size_t p = begin; p < end; ++p) {
+        run_piece(source, selection, pieces_[p], f);
+      }
+      finish(thread, threads);
+      executor->leave(thread);
+    }
+    executor->end();
+  }
+
+  // Calls f(row, key, value) in parallel for every row of source that passes
+  // the select_rows and select hooks. Work is handed out by piece, so a paged
+  // collection is run one chunk at a time. With a deadline, the pieces are run
+  // a round at a time, with after_round() called after each, until the
+  // deadline has passed. Returns false if rows were left for the next run.
+  template<typename Function_, typename Round_>
+  bool for_each_row(Collection* source, Function_ f, Round_ after_round) {
+    return for_each_row(source, f, [] {}, after_round, [](size_t, size_t) {});
+  }
+
+  // Same as above, with start() called before any row when the run begins at
+  // the first row instead of carrying on from the last run, and
+  // finish(thread, threads) called by every thread at the end of the
+  // parallel region that runs the last of the rows.
+  template<typename Function_, typename Start_, typename Round_,
+           typename Finish_>
+  bool for_each_row(Collection* source, Function_ f, Start_ start,
+                    Round_ after_round, Finish_ finish) {
+    typedef std::chrono::steady_clock Clock;
+    bind(source);
+    Selection selection = select_rows(source);
+    split(source, selection);
+
+    // A selection that has shrunk past the rows left over starts over.
+    size_t first = 0;
+    if (resume_ < selection.count) {
+      first = std::lower_bound(pieces_.begin(), pieces_.end(), resume_,
+                               [](const Piece& piece, uint64_t row) {
+                                 return piece.first < row;
+                               }) - pieces_.begin();
+    }
+    if (first == 0) {
+      start();
+    }
+    resume_ = 0;
+
+    if (context_.deadline == Clock::time_point::max()) {
+      run_pieces(source, selection, first, pieces_.size(), f, finish);
+      after_round();
+      return true;
+    }
+
+    size_t round = context_.executor->workers() * ROUND_PIECES;
+    while (first < pieces_.size()) {
+      size_t last = std::min(first + round, pieces_.size());
+      bool done = last == pieces_.size();
+      run_pieces(source, selection, first, last, f,
+                 [done, &finish](size_t thread, size_t threads) {
+                   if (done) {
+                     finish(thread, threads);
+                   }
+                 });
+      after_round();
+      first = last;
+      if (first < pieces_.size() && Clock::now() >= context_.deadline) {
+        resume_ = pieces_[first].first;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool run_1_to_0() {
+    Collection* source = sources_[0];
+    auto f = [this, source](uint64_t row, uint8_t* key, uint8_t* value) {
+      Stack* stack = context_.scratch->local();
+      source->copy(key, value, row, stack);
+      pipeline_->transform(stack);
+      stack->clear();
+    };
+    return for_each_row(source, f, [] {});
+  }
+
+  bool run_1_to_1() {
+    Collection* source = sources_[0];
+    Collection* sink = sinks_[0];
+    auto f = [this, source, sink](uint64_t row, uint8_t* key, uint8_t* value) {
+      Stack* stack = context_.scratch->local();
+      source->copy(key, value, row, stack);
+      pipeline_->transform(stack);
+      sink->mutate(sink, (const Mutation*)stack->top());
+      stack->clear();
+    };
+    return for_each_row(source, f, [] {});
+  }
+
+  // Each thread transforms a contiguous range of elements and copies the
+  // resulting mutations into its own staging buffer. After each round the
+  // buffers are applied in lane order, which is element order.
+  bool run_1_to_1_deterministic() {
+    Collection* source = sources_[0];
+    Collection* sink = sinks_[0];
+
+    staging_.resize(context_.executor->workers());
+    for (auto& buffer : staging_) {
+      buffer.size = 0;
+    }
+
+    auto f = [this, source, sink](uint64_t row, uint8_t* key, uint8_t* value) {
+      Stack* stack = context_.scratch->local();
+      source->copy(key, value, row, stack);
+      pipeline_->transform(stack);
+      stage(&staging_[lane_of_thread_[omp_get_thread_num()]],
+            (const uint8_t*)stack->top(), stack->top_size());
+      stack->clear();
+    };
+
+    auto apply = [this, sink] {
+      for (auto& buffer : staging_) {
+        uint8_t* p = buffer.data.data();
+        uint8_t* end = p + buffer.size;
+        while (p < end) {
+          StagedMutation* staged = (StagedMutation*)p;
+          Mutation* m = (Mutation*)(p + sizeof(StagedMutation));
+          m->element = (uint8_t*)m + staged->element_offset;
+          sink->mutate(sink, m);
+          p += sizeof(StagedMutation) + staged->size;
+        }
+        buffer.size = 0;
+      }
+    };
+    return for_each_row(source, f, apply);
+  }
+
+  // Each lane folds its rows into its own partial. Once every row is folded
+  // the team combines the partials pairwise, log2(lanes) levels deep, and the
+  // result is loaded into the sink. A run cut short by the deadline keeps its
+  // partials and carries on with them in the next frame. If the source has
+  // shrunk past where the run stopped, it starts over with fresh partials.
+  bool run_reduce() {
     Collection* source = sources_[0];
-    uint64_t count = source->count(source);
+    Collection* sink = sinks_[0];
+
+    auto f = [this, source](uint64_t row, uint8_t* key, uint8_t* value) {
+      Stack* stack = context_.scratch->local();
+      source->copy(key, value, row, stack);
+      if (pipeline_->transform) {
+        pipeline_->transform(stack);
+      }
+      pipeline_->reduce.accumulate(
+          stack, partial(lane_of_thread_[omp_get_thread_num()]));
+      stack->clear();
+    };
+    auto combine = [this](size_t thread, size_t threads) {
+      combine_partials(thread, threads);
+    };
+    auto start = [this] {
+      reset_partials();
+    };
+    if (!for_each_row(source, f, start, [] {}, combine)) {
+      return false;
+    }
+
+    if (sink->load) {
+      std::vector<uint8_t> key(sink->keys.size);
+      sink->load(sink, key.data(), partial(0), 1);
+    }
+    return true;
+  }
+
+  inline uint8_t* partial(size_t lane) {
+    return partials_[lane * partial_lines_].data;
+  }
+
+  void reset_partials() {
+    const Reduction& reduce = pipeline_->reduce;
+    size_t lines = std::max<size_t>(
+        (reduce.size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE, 1);
+    size_t count = context_.executor->workers();
+    if (lines != partial_lines_ || count != partial_count_) {
+      partials_.reset((Line*)aligned_alloc(CACHE_LINE_SIZE,
+                                           lines * count * sizeof(Line)));
+      partial_lines_ = lines;
+      partial_count_ = count;
+    }
+    for (size_t lane = 0; lane < count; ++lane) {
+      memcpy(partial(lane), reduce.identity, reduce.size);
+    }
+  }
 
-#pragma omp parallel for
-    for(uint64_t i = 0; i < count; ++i) {
-      thread_local static Stack stack;
-      source->copy(
-          source->keys.data + source->keys.offset + i * source->keys.size,
-          source->values.data + source->values.offset + i * source->values.size,
-          i, &stack);
-      pipeline_->transform(&stack);
-      stack.clear();
+  // Called by every thread of the team. At each level the partial of every
+  // other remaining lane is folded into its neighbor's, so lane 0 ends up
+  // with the result.
+  void combine_partials(size_t thread, size_t threads) {
+    Combine combine = pipeline_->reduce.combine;
+    for (size_t stride = 1; stride < partial_count_; stride *= 2) {
+#pragma omp barrier
+      for (size_t lane = thread * 2 * stride; lane + stride < partial_count_;
+           lane += threads * 2 * stride) {
+        combine(partial(lane), partial(lane + stride));
+      }
     }
   }
 
-  void run_1_to_1() {
+  // Each lane collects the rows it keeps. At the end of the same parallel
+  // region the lanes' counts are turned into output offsets with an
+  // exclusive prefix sum, and every lane copies its rows' keys and values to
+  // its offset. The output is then loaded into the sink in one call, in the
+  // source's row order. Always runs to the end, whatever the deadline.
+  bool run_compact() {
     Collection* source = sources_[0];
     Collection* sink = sinks_[0];
-    uint64_t count = source->count(source);
+    DEBUG_ASSERT(compatible(), Status::Code::INCOMPATIBLE_DATA_TYPES);
+    if (!compatible()) {
+      return true;
+    }
+    context_.deadline = std::chrono::steady_clock::time_point::max();
+
+    size_t workers = context_.executor->workers();
+    kept_.resize(workers);
+    kept_offsets_.resize(workers + 1);
+    for (Kept& kept : kept_) {
+      kept.rows.clear();
+    }
+
+    auto f = [this](uint64_t row, uint8_t*, uint8_t*) {
+      kept_[lane_of_thread_[omp_get_thread_num()]].rows.push_back(row);
+    };
+    auto scatter = [this, source](size_t thread, size_t threads) {
+#pragma omp barrier
+#pragma omp single
+      {
+        kept_offsets_[0] = 0;
+        for (size_t lane = 0; lane < threads; ++lane) {
+          kept_offsets_[lane + 1] =
+              kept_offsets_[lane] + kept_[lane].rows.size();
+        }
+        kept_keys_.resize(kept_offsets_[threads] * source->keys.size);
+        kept_values_.resize(kept_offsets_[threads] * source->values.size);
+      }
+      size_t lane = lane_of_thread_[thread];
+      copy_rows(source, kept_[lane].rows, kept_offsets_[lane]);
+    };
+    for_each_row(source, f, [] {}, [] {}, scatter);
+
+    uint64_t count = 0;
+    for (const Kept& kept : kept_) {
+      count += kept.rows.size();
+    }
+    sink->load(sink, kept_keys_.data(), kept_values_.data(), count);
+    return true;
+  }
 
-#pragma omp parallel for
-    for(uint64_t i = 0; i < count; ++i) {
-      thread_local static Stack stack;
-      source->copy(
-          source->keys.data + source->keys.offset + i * source->keys.size,
-          source->values.data + source->values.offset + i * source->values.size,
-          i, &stack);
-      pipeline_->transform(&stack);
-      sink->mutate(sink, (const Mutation*)stack.top());
-      stack.clear();
+  // Copies the keys and values of rows to the output, starting at offset.
+  void copy_rows(Collection* source, const std::vector<uint64_t>& rows,
+                 uint64_t offset) {
+    Cursor cursor(source);
+    size_t key_size = source->keys.size;
+    size_t value_size = source->values.size;
+    uint8_t* keys = kept_keys_.data() + offset * key_size;
+    uint8_t* values = kept_values_.data() + offset * value_size;
+    for (uint64_t row : rows) {
+      cursor.seek(row);
+      memcpy(keys, cursor.key(row), key_size);
+      memcpy(values, cursor.value(row), value_size);
+      keys += key_size;
+      values += value_size;
     }
   }
 
@@ -232,11 +1154,21 @@ class ProgramImpl {
   }
 
   Status::Code enable_pipeline(struct Pipeline* pipeline, ExecutionPolicy policy) {
+    if (!((PipelineImpl*)pipeline->self)->compatible()) {
+      return Status::INCOMPATIBLE_DATA_TYPES;
+    }
     disable_pipeline(pipeline);
 
     if (policy.trigger == Trigger::LOOP) {
+      // Highest priority first, then in the order they were added.
+      ((PipelineImpl*)pipeline->self)->set_priority(policy.priority);
       loop_pipelines_.push_back(pipeline);
-      std::sort(loop_pipelines_.begin(), loop_pipelines_.end());
+      std::sort(loop_pipelines_.begin(), loop_pipelines_.end(),
+                [](const Pipeline* a, const Pipeline* b) {
+                  int16_t pa = ((PipelineImpl*)a->self)->priority();
+                  int16_t pb = ((PipelineImpl*)b->self)->priority();
+                  return pa != pb ? pa > pb : a->id < b->id;
+                });
     } else if (policy.trigger == Trigger::EVENT) {
       event_pipelines_.insert(pipeline);
     } else {
@@ -247,7 +1179,7 @@ class ProgramImpl {
   }
 
   Status::Code disable_pipeline(struct Pipeline* pipeline) {
-    auto found = std::lower_bound(loop_pipelines_.begin(), loop_pipelines_.end(), pipeline);
+    auto found = std::find(loop_pipelines_.begin(), loop_pipelines_.end(), pipeline);
     if (found != loop_pipelines_.end()) {
       loop_pipelines_.erase(found);
     }
@@ -270,9 +1202,38 @@ class ProgramImpl {
     return std::find(pipelines_.begin(), pipelines_.end(), pipeline) != pipelines_.end();
   }
 
-  void run() {
+  // The deferred state of every pipeline, in the order they were added.
+  std::vector<PipelineImpl::Deferred> deferred() const {
+    std::vector<PipelineImpl::Deferred> ret;
+    for (Pipeline* p : pipelines_) {
+      ret.push_back(((PipelineImpl*)p->self)->deferred());
+    }
+    return ret;
+  }
+
+  void restore(const std::vector<PipelineImpl::Deferred>& deferred) {
+    for (size_t i = 0; i < deferred.size() && i < pipelines_.size(); ++i) {
+      ((PipelineImpl*)pipelines_[i]->self)->restore(deferred[i]);
+    }
+  }
+
+  // Pipelines at or above the critical priority always run all their rows.
+  // The others are skipped once the deadline has passed, or stop at it.
+  void run(const RunContext& context, FrameStats* stats) {
+    typedef std::chrono::steady_clock Clock;
     for(Pipeline* p : loop_pipelines_) {
-      ((PipelineImpl*)p->self)->run();
+      PipelineImpl* pipeline = (PipelineImpl*)p->self;
+      RunContext c = context;
+      if (pipeline->priority() >= context.critical_priority) {
+        c.deadline = Clock::time_point::max();
+      } else if (context.deadline != Clock::time_point::max() &&
+                 Clock::now() >= context.deadline) {
+        ++stats->skipped;
+        continue;
+      }
+      if (!pipeline->run(c)) {
+        ++stats->deferred;
+      }
     }
   }
 
@@ -322,6 +1283,14 @@ class ProgramImpl {
 
 class ProgramRegistry {
  public:
+  ~ProgramRegistry() {
+    for (Program* p : programs_.values) {
+      delete to_impl(p);
+      free((char*)p->name);
+      free(p);
+    }
+  }
+
   Id create_program(const char* program) {
     Id id = programs_.find(program);
     if (id == -1) {
@@ -355,6 +1324,10 @@ class ProgramRegistry {
     return programs_[id];
   }
 
+  std::vector<std::string> names() const {
+    return programs_.keys;
+  }
+
   inline ProgramImpl* to_impl(Program* p) {
     return (ProgramImpl*)(p->self);
   }
@@ -364,7 +1337,7 @@ class ProgramRegistry {
     Program* p = (Program*)malloc(sizeof(Program));
     memset(p, 0, sizeof(Program));
     *(Id*)(&p->id) = id;
-    *(char**)(&p->name) = (char*)name;
+    *(char**)(&p->name) = strdup(name);
     return p;
   }
 
@@ -385,11 +1358,16 @@ class PrivateUniverse {
   PrivateUniverse();
   ~PrivateUniverse();
 
-  Status::Code init();
+  Status::Code init(const ExecutorConfig& config);
   Status::Code start();
   Status::Code stop();
   Status::Code loop();
 
+  Fence loop_async();
+  Status::Code wait_frame(Fence fence);
+  Status::Code watch_collection(Collection* collection);
+  Status::Code read_view(Collection* collection, ReadView* view);
+
   Id create_program(const char* name);
 
   // Pipeline manipulation.
@@ -400,6 +1378,9 @@ class PrivateUniverse {
   Status::Code enable_pipeline(struct Pipeline* pipeline, ExecutionPolicy policy);
   Status::Code disable_pipeline(struct Pipeline* pipeline);
 
+  struct Job* add_job();
+  Status::Code remove_job(struct Job* job);
+
   // Collection manipulation.
   Collection* add_collection(const char* program, const char* collection);
 
@@ -409,14 +1390,62 @@ class PrivateUniverse {
   Status::Code share_collection(const char* source, const char* dest);
   Status::Code copy_collection(const char* source, const char* dest);
 
+  Status::Code set_reorder_budget(uint64_t budget_ns);
+
+  Status::Code set_execution_mode(ExecutionMode mode);
+  Status::Code set_frame_budget(uint64_t budget_ns, int16_t critical_priority);
+  FrameStats frame_stats();
+  Status::Code shrink_collection(Collection* collection);
+  ScratchStats scratch_stats();
+  uint64_t numa_nodes();
+  uint64_t worker_count();
+  Status::Code worker_stats(uint64_t worker, WorkerStats* stats);
+  uint64_t hash_collections();
+  Status::Code verify_loop();
+
+  Status::Code save_snapshot(const char* path, Compression compression);
+  Status::Code load_snapshot(const char* path);
+
  private:
   Status::Code transition(RunState allowed, RunState next);
   Status::Code transition(std::vector<RunState>&& allowed, RunState next);
 
+  // The parts of a loop(): merging the ingested mutations, running the
+  // pipelines of the main program, and the jobs and upkeep after them.
+  std::chrono::steady_clock::time_point begin_frame();
+  void run_frame(std::chrono::steady_clock::time_point start,
+                 FrameStats* stats);
+  Status::Code end_frame(std::chrono::steady_clock::time_point start);
+
+  // Body of the thread that runs the frames started by loop_async().
+  void run_async();
+  void join_async();
+
   CollectionRegistry collections_;
   ProgramRegistry programs_;
+  JobRegistry jobs_;
+  ScratchRegistry scratch_;
+  numa::Topology topology_;
+  Executor executor_;
+
+  // Frames run by loop_async(). Guarded by async_mutex_.
+  std::thread async_thread_;
+  std::mutex async_mutex_;
+  std::condition_variable async_cv_;
+  Fence started_ = 0;
+  Fence finished_ = 0;
+  Status::Code async_status_ = Status::OK;
+  bool quit_ = false;
+  ReadViews views_;
 
   RunState run_state_;
+
+  uint64_t reorder_budget_ns_;
+  ExecutionMode execution_mode_;
+
+  uint64_t frame_budget_ns_ = 0;
+  int16_t critical_priority_ = MAX_PRIORITY;
+  FrameStats frame_stats_ = {};
 };
 
 }  // namespace radiance
@@ -16,7 +16,7 @@ Status::Code init(Universe* u) {
   universe_ = u;
   universe_->self = new PrivateUniverse();
 
-  return AS_PRIVATE(init());
+  return AS_PRIVATE(init(u->executor));
 }
 
 Status::Code start() {
@@ -33,6 +33,22 @@ Status::Code loop() {
   return AS_PRIVATE(loop());
 }
 
+Fence loop_async() {
+  return AS_PRIVATE(loop_async());
+}
+
+Status::Code wait_frame(Fence fence) {
+  return AS_PRIVATE(wait_frame(fence));
+}
+
+Status::Code watch_collection(Collection* collection) {
+  return AS_PRIVATE(watch_collection(collection));
+}
+
+Status::Code read_view(Collection* collection, ReadView* view) {
+  return AS_PRIVATE(read_view(collection, view));
+}
+
 Id create_program(const char* name) {
   return AS_PRIVATE(create_program(name));
 }
@@ -57,6 +73,14 @@ Status::Code disable_pipeline(struct Pipeline* pipeline) {
   return AS_PRIVATE(disable_pipeline(pipeline));
 }
 
+struct Job* add_job() {
+  return AS_PRIVATE(add_job());
+}
+
+Status::Code remove_job(struct Job* job) {
+  return AS_PRIVATE(remove_job(job));
+}
+
 Collection* add_collection(const char* program, const char* name) {
   return AS_PRIVATE(add_collection(program, name));
 }
@@ -77,4 +101,56 @@ Status::Code copy_collection(const char* source, const char* dest) {
   return AS_PRIVATE(copy_collection(source, dest));
 }
 
+Status::Code set_reorder_budget(uint64_t budget_ns) {
+  return AS_PRIVATE(set_reorder_budget(budget_ns));
+}
+
+Status::Code set_execution_mode(ExecutionMode mode) {
+  return AS_PRIVATE(set_execution_mode(mode));
+}
+
+Status::Code set_frame_budget(uint64_t budget_ns, int16_t critical_priority) {
+  return AS_PRIVATE(set_frame_budget(budget_ns, critical_priority));
+}
+
+FrameStats frame_stats() {
+  return AS_PRIVATE(frame_stats());
+}
+
+Status::Code shrink_collection(Collection* collection) {
+  return AS_PRIVATE(shrink_collection(collection));
+}
+
+ScratchStats scratch_stats() {
+  return AS_PRIVATE(scratch_stats());
+}
+
+uint64_t numa_nodes() {
+  return AS_PRIVATE(numa_nodes());
+}
+
+uint64_t worker_count() {
+  return AS_PRIVATE(worker_count());
+}
+
+Status::Code worker_stats(uint64_t worker, WorkerStats* stats) {
+  return AS_PRIVATE(worker_stats(worker, stats));
+}
+
+uint64_t hash_collections() {
+  return AS_PRIVATE(hash_collections());
+}
+
+Status::Code verify_loop() {
+  return AS_PRIVATE(verify_loop());
+}
+
+Status::Code save_snapshot(const char* path, Compression compression) {
+  return AS_PRIVATE(save_snapshot(path, compression));
+}
+
+Status::Code load_snapshot(const char* path) {
+  return AS_PRIVATE(load_snapshot(path));
+}
+
 }  // namespace radiance
@@ -0,0 +1,494 @@
+#include "snapshot.h"
+#include "compression.h"
+#include "spans.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char MAGIC[8] = {'R', 'D', 'N', 'C', 'S', 'N', 'A', 'P'};
+const uint32_t VERSION = 1;
+const uint64_t ALIGNMENT = 64;
+const uint64_t BLOCK_SIZE = 1 << 20;
+
+const uint8_t PADDING[ALIGNMENT] = {0};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t compression;
+  uint64_t program_count;
+  uint64_t collection_count;
+};
+
+struct ColumnInfo {
+  uint64_t element_size;
+  uint64_t offset;
+  uint64_t stored_size;
+};
+
+struct BlockInfo {
+  uint32_t raw_size;
+  uint32_t stored_size;
+};
+
+inline uint64_t align(uint64_t n) {
+  return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+// A column as it will be written: either a single raw range or a list of
+// blocks, some of which may be compressed.
+struct Column {
+  const uint8_t* data;
+  uint64_t size;
+
+  bool blocked;
+  std::vector<BlockInfo> blocks;
+  std::vector<std::vector<uint8_t>> compressed;
+
+  uint64_t stored_size() const {
+    if (!blocked) {
+      return size;
+    }
+    uint64_t ret = sizeof(uint64_t) + blocks.size() * sizeof(BlockInfo);
+    for (const BlockInfo& b : blocks) {
+      ret += b.stored_size;
+    }
+    return ret;
+  }
+};
+
+void append(std::vector<uint8_t>* buf, const void* data, size_t size) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  buf->insert(buf->end(), bytes, bytes + size);
+}
+
+template<typename Type_>
+void append(std::vector<uint8_t>* buf, const Type_& t) {
+  append(buf, &t, sizeof(Type_));
+}
+
+void append_string(std::vector<uint8_t>* buf, const std::string& s) {
+  append(buf, (uint32_t)s.size());
+  append(buf, s.data(), s.size());
+}
+
+// Writes all of iov, continuing after short writes.
+bool write_all(int fd, std::vector<iovec>* iov) {
+  size_t i = 0;
+  while (i < iov->size()) {
+    int count = (int)std::min<size_t>(iov->size() - i, IOV_MAX);
+    ssize_t written = writev(fd, iov->data() + i, count);
+    if (written < 0) {
+      return false;
+    }
+
+    while (i < iov->size() && (size_t)written >= (*iov)[i].iov_len) {
+      written -= (*iov)[i].iov_len;
+      ++i;
+    }
+    if (written > 0) {
+      (*iov)[i].iov_base = (uint8_t*)(*iov)[i].iov_base + written;
+      (*iov)[i].iov_len -= written;
+    }
+  }
+  return true;
+}
+
+// Flushes the directory that holds path, which makes a rename into it
+// durable.
+bool sync_directory(const char* path) {
+  std::string p(path);
+  size_t slash = p.rfind('/');
+  std::string dir = slash == std::string::npos ? "." :
+      slash == 0 ? "/" : p.substr(0, slash);
+  int fd = open(dir.data(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  return ok;
+}
+
+void compress_columns(std::vector<Column>* columns) {
+  struct Job {
+    Column* column;
+    uint64_t block;
+  };
+
+  std::vector<Job> jobs;
+  for (Column& c : *columns) {
+    uint64_t block_count = (c.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    c.blocked = true;
+    c.blocks.resize(block_count);
+    c.compressed.resize(block_count);
+    for (uint64_t b = 0; b < block_count; ++b) {
+      jobs.push_back({&c, b});
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic)
+  for (uint64_t i = 0; i < jobs.size(); ++i) {
+    Column* c = jobs[i].column;
+    uint64_t b = jobs[i].block;
+    uint64_t begin = b * BLOCK_SIZE;
+    uint32_t raw_size = (uint32_t)std::min(BLOCK_SIZE, c->size - begin);
+
+    std::vector<uint8_t>& out = c->compressed[b];
+    out.resize(radiance::lz::bound(raw_size));
+    size_t stored = radiance::lz::compress(c->data + begin, raw_size, out.data());
+    if (stored < raw_size) {
+      out.resize(stored);
+    } else {
+      // Written straight from the collection instead.
+      std::vector<uint8_t>().swap(out);
+      stored = raw_size;
+    }
+    c->blocks[b] = {raw_size, (uint32_t)stored};
+  }
+}
+
+class Reader {
+ public:
+  Reader(const uint8_t* begin, const uint8_t* end) :
+      begin_(begin), p_(begin), end_(end), ok_(true) {}
+
+  template<typename Type_>
+  Type_ read() {
+    Type_ t;
+    memset(&t, 0, sizeof(Type_));
+    if ((size_t)(end_ - p_) < sizeof(Type_)) {
+      ok_ = false;
+      return t;
+    }
+    memcpy(&t, p_, sizeof(Type_));
+    p_ += sizeof(Type_);
+    return t;
+  }
+
+  std::string read_string() {
+    uint32_t size = read<uint32_t>();
+    if ((size_t)(end_ - p_) < size) {
+      ok_ = false;
+      return "";
+    }
+    std::string s((const char*)p_, size);
+    p_ += size;
+    return s;
+  }
+
+  const uint8_t* at(uint64_t offset, uint64_t size) const {
+    uint64_t file_size = end_ - begin_;
+    if (offset > file_size || size > file_size - offset) {
+      return nullptr;
+    }
+    return begin_ + offset;
+  }
+
+  bool ok() const {
+    return ok_;
+  }
+
+ private:
+  const uint8_t* begin_;
+  const uint8_t* p_;
+  const uint8_t* end_;
+  bool ok_;
+};
+
+struct Entry {
+  std::string name;
+  ColumnInfo keys;
+  ColumnInfo values;
+  uint64_t count;
+  radiance::Collection* collection;
+
+  // The decoded columns, and the buffers they were decompressed into.
+  const uint8_t* key_data;
+  const uint8_t* value_data;
+  std::vector<uint8_t> key_buffer;
+  std::vector<uint8_t> value_buffer;
+};
+
+// Returns a pointer to the column's raw bytes. Uncompressed columns point
+// straight into the mapped file, compressed columns are decompressed into
+// buffer.
+const uint8_t* read_column(const Reader& reader, const ColumnInfo& info,
+                           uint64_t raw_size, radiance::Compression compression,
+                           std::vector<uint8_t>* buffer) {
+  if (compression == radiance::Compression::NONE) {
+    if (info.stored_size != raw_size) {
+      return nullptr;
+    }
+    return reader.at(info.offset, raw_size);
+  }
+
+  const uint8_t* column = reader.at(info.offset, info.stored_size);
+  if (!column || info.stored_size < sizeof(uint64_t)) {
+    return nullptr;
+  }
+
+  uint64_t block_count;
+  memcpy(&block_count, column, sizeof(uint64_t));
+  if (block_count > (info.stored_size - sizeof(uint64_t)) / sizeof(BlockInfo)) {
+    return nullptr;
+  }
+
+  std::vector<BlockInfo> blocks(block_count);
+  std::vector<uint64_t> src_offsets(block_count);
+  std::vector<uint64_t> dst_offsets(block_count);
+  memcpy(blocks.data(), column + sizeof(uint64_t), block_count * sizeof(BlockInfo));
+
+  uint64_t src = sizeof(uint64_t) + block_count * sizeof(BlockInfo);
+  uint64_t dst = 0;
+  for (uint64_t b = 0; b < block_count; ++b) {
+    src_offsets[b] = src;
+    dst_offsets[b] = dst;
+    src += blocks[b].stored_size;
+    dst += blocks[b].raw_size;
+  }
+  if (src != info.stored_size || dst != raw_size) {
+    return nullptr;
+  }
+
+  buffer->resize(raw_size);
+  bool ok = true;
+#pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+  for (uint64_t b = 0; b < block_count; ++b) {
+    const uint8_t* in = column + src_offsets[b];
+    uint8_t* out = buffer->data() + dst_offsets[b];
+    if (blocks[b].stored_size == blocks[b].raw_size) {
+      memcpy(out, in, blocks[b].raw_size);
+    } else {
+      ok = ok && radiance::lz::decompress(in, blocks[b].stored_size,
+                                          out, blocks[b].raw_size);
+    }
+  }
+  return ok ? buffer->data() : nullptr;
+}
+
+}  // namespace
+
+namespace radiance {
+namespace snapshot {
+
+Status::Code save(const char* path, Compression compression,
+                  const std::vector<std::string>& programs,
+                  const std::vector<NamedCollection>& collections) {
+  std::vector<uint64_t> counts;
+  std::vector<Column> columns;
+  counts.reserve(collections.size());
+  columns.reserve(2 * collections.size());
+
+  // Collections that are not stored in one array are copied into one first.
+  std::vector<std::vector<uint8_t>> gathered;
+  gathered.reserve(2 * collections.size());
+
+  for (const NamedCollection& nc : collections) {
+    Collection* c = nc.collection;
+    uint64_t count = c->count ? c->count(c) : 0;
+    counts.push_back(count);
+
+    bind(c);
+    const uint8_t* keys = c->keys.data + c->keys.offset;
+    const uint8_t* values = c->values.data + c->values.offset;
+    if (c->span) {
+      gathered.emplace_back();
+      gathered.emplace_back();
+      gather(c, count, &gathered[gathered.size() - 2], &gathered.back());
+      keys = gathered[gathered.size() - 2].data();
+      values = gathered.back().data();
+    }
+    columns.push_back({keys, count * c->keys.size, false, {}, {}});
+    columns.push_back({values, count * c->values.size, false, {}, {}});
+  }
+
+  if (compression == Compression::LZ) {
+    compress_columns(&columns);
+  }
+
+  // The header's size is needed to know where the columns start, so the
+  // column offsets are patched in after it is laid out.
+  std::vector<uint8_t> header;
+  FileHeader file_header;
+  memcpy(file_header.magic, MAGIC, sizeof(MAGIC));
+  file_header.version = VERSION;
+  file_header.compression = (uint32_t)compression;
+  file_header.program_count = programs.size();
+  file_header.collection_count = collections.size();
+  append(&header, file_header);
+
+  for (const std::string& program : programs) {
+    append_string(&header, program);
+  }
+
+  std::vector<size_t> info_offsets;
+  for (size_t i = 0; i < collections.size(); ++i) {
+    append_string(&header, collections[i].name);
+    info_offsets.push_back(header.size());
+    append(&header, ColumnInfo{});
+    append(&header, ColumnInfo{});
+    append(&header, counts[i]);
+  }
+  header.resize(align(header.size()), 0);
+
+  uint64_t offset = header.size();
+  for (size_t i = 0; i < collections.size(); ++i) {
+    const Collection* c = collections[i].collection;
+    ColumnInfo infos[2];
+    uint64_t sizes[2] = {(uint64_t)c->keys.size, (uint64_t)c->values.size};
+    for (int j = 0; j < 2; ++j) {
+      const Column& column = columns[2 * i + j];
+      infos[j] = {sizes[j], offset, column.stored_size()};
+      offset = align(offset + infos[j].stored_size);
+    }
+    memcpy(header.data() + info_offsets[i], infos, sizeof(infos));
+  }
+
+  // Lay out the whole file as one gather list so that it goes out in a few
+  // large sequential writes straight from the collections' memory.
+  std::vector<iovec> iov;
+  std::vector<uint64_t> block_counts(columns.size());
+  iov.push_back({header.data(), header.size()});
+  for (size_t i = 0; i < columns.size(); ++i) {
+    const Column& column = columns[i];
+    if (compression == Compression::LZ) {
+      block_counts[i] = column.blocks.size();
+      iov.push_back({&block_counts[i], sizeof(uint64_t)});
+      iov.push_back({(void*)column.blocks.data(),
+                     column.blocks.size() * sizeof(BlockInfo)});
+      for (size_t b = 0; b < column.blocks.size(); ++b) {
+        if (column.compressed[b].empty()) {
+          iov.push_back({(void*)(column.data + b * BLOCK_SIZE),
+                         column.blocks[b].raw_size});
+        } else {
+          iov.push_back({(void*)column.compressed[b].data(),
+                         column.compressed[b].size()});
+        }
+      }
+    } else if (column.size) {
+      iov.push_back({(void*)column.data, column.size});
+    }
+
+    uint64_t stored = column.stored_size();
+    if (align(stored) != stored) {
+      iov.push_back({(void*)PADDING, align(stored) - stored});
+    }
+  }
+
+  // Write to the side and rename so that a crash mid-write never leaves a
+  // torn snapshot at path. The directory is synced after the rename, or the
+  // rename itself could be lost on power loss.
+  std::string tmp_path = std::string(path) + ".tmp";
+  int fd = open(tmp_path.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return Status::IO_ERROR;
+  }
+
+  bool ok = write_all(fd, &iov) && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmp_path.data(), path) != 0) {
+    unlink(tmp_path.data());
+    return Status::IO_ERROR;
+  }
+  return sync_directory(path) ? Status::OK : Status::IO_ERROR;
+}
+
+Status::Code load(const char* path, ProgramCreator create_program,
+                  CollectionLookup find_collection) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return Status::DOES_NOT_EXIST;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return Status::IO_ERROR;
+  }
+
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return Status::IO_ERROR;
+  }
+  madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+  const uint8_t* begin = (const uint8_t*)addr;
+  Reader reader(begin, begin + st.st_size);
+  Status::Code status = Status::OK;
+
+  FileHeader file_header = reader.read<FileHeader>();
+  Compression compression = (Compression)file_header.compression;
+  std::vector<std::string> programs;
+  std::vector<Entry> entries;
+  if (!reader.ok() || memcmp(file_header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      file_header.version != VERSION ||
+      (compression != Compression::NONE && compression != Compression::LZ)) {
+    status = Status::INCOMPATIBLE_DATA_TYPES;
+  }
+
+  for (uint64_t i = 0; status == Status::OK && i < file_header.program_count; ++i) {
+    programs.push_back(reader.read_string());
+    status = reader.ok() ? Status::OK : Status::INCOMPATIBLE_DATA_TYPES;
+  }
+
+  for (uint64_t i = 0; status == Status::OK && i < file_header.collection_count; ++i) {
+    Entry e;
+    e.name = reader.read_string();
+    e.keys = reader.read<ColumnInfo>();
+    e.values = reader.read<ColumnInfo>();
+    e.count = reader.read<uint64_t>();
+    if (!reader.ok()) {
+      status = Status::INCOMPATIBLE_DATA_TYPES;
+      break;
+    }
+
+    e.collection = find_collection(e.name);
+    if (!e.collection || !e.collection->load) {
+      status = Status::DOES_NOT_EXIST;
+    } else if (e.collection->keys.size != e.keys.element_size ||
+               e.collection->values.size != e.values.element_size) {
+      status = Status::INCOMPATIBLE_DATA_TYPES;
+    }
+    entries.push_back(e);
+  }
+
+  // Every column is decoded and checked before anything is loaded, so that
+  // a corrupt snapshot leaves the universe as it was.
+  for (size_t i = 0; status == Status::OK && i < entries.size(); ++i) {
+    Entry& e = entries[i];
+    e.key_data = read_column(reader, e.keys, e.count * e.keys.element_size,
+                             compression, &e.key_buffer);
+    e.value_data = read_column(reader, e.values,
+                               e.count * e.values.element_size, compression,
+                               &e.value_buffer);
+    if ((!e.key_data || !e.value_data) && e.count) {
+      status = Status::INCOMPATIBLE_DATA_TYPES;
+    }
+  }
+
+  if (status == Status::OK) {
+    for (const std::string& program : programs) {
+      create_program(program);
+    }
+    for (const Entry& e : entries) {
+      e.collection->load(e.collection, e.key_data, e.value_data, e.count);
+    }
+  }
+
+  munmap(addr, st.st_size);
+  return status;
+}
+
+}  // namespace snapshot
+}  // namespace radiance
@@ -0,0 +1,45 @@
+#ifndef SNAPSHOT__H
+#define SNAPSHOT__H
+
+#include "radiance.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace radiance {
+namespace snapshot {
+
+// Snapshot file layout, little-endian, every column aligned to 64 bytes:
+//   FileHeader
+//   program names: { uint32 length, bytes }[program_count]
+//   collection entries: { uint32 length, name bytes, ColumnInfo keys,
+//                         ColumnInfo values, uint64 count }[collection_count]
+//   column data
+//
+// An uncompressed column is the raw array. A compressed column is a uint64
+// block count, a BlockInfo per block, then the blocks back to back. Blocks
+// that do not compress are stored raw.
+
+struct NamedCollection {
+  std::string name;
+  Collection* collection;
+};
+
+typedef std::function<Collection*(const std::string&)> CollectionLookup;
+typedef std::function<void(const std::string&)> ProgramCreator;
+
+Status::Code save(const char* path, Compression compression,
+                  const std::vector<std::string>& programs,
+                  const std::vector<NamedCollection>& collections);
+
+// Collections are matched by name against already registered collections,
+// which must have a Load hook. Nothing is modified unless every collection in
+// the snapshot is registered with matching key and value sizes.
+Status::Code load(const char* path, ProgramCreator create_program,
+                  CollectionLookup find_collection);
+
+}  // namespace snapshot
+}  // namespace radiance
+
+#endif  // SNAPSHOT__H
@@ -0,0 +1,55 @@
+#ifndef SPANS__H
+#define SPANS__H
+
+#include "radiance.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace radiance {
+
+// Points the keys and values of c at its current storage.
+inline void bind(Collection* c) {
+  if (c->bind) {
+    c->bind(c);
+  }
+}
+
+// Calls f(keys, values, count) for every run of the first count rows of c
+// that is stored contiguously, in row order.
+template<typename Function_>
+void for_each_span(Collection* c, uint64_t count, Function_ f) {
+  bind(c);
+  if (!c->span) {
+    f(c->keys.data + c->keys.offset, c->values.data + c->values.offset, count);
+    return;
+  }
+  for (uint64_t row = 0; row < count;) {
+    Span span;
+    c->span(c, row, &span);
+    if (span.count == 0) {
+      break;
+    }
+    uint64_t n = std::min(span.first + span.count, count) - row;
+    f(span.keys + (row - span.first) * c->keys.size,
+      span.values + (row - span.first) * c->values.size, n);
+    row += n;
+  }
+}
+
+// Copies the raw keys and values of the first count rows of c.
+inline void gather(Collection* c, uint64_t count,
+                   std::vector<uint8_t>* keys, std::vector<uint8_t>* values) {
+  keys->clear();
+  values->clear();
+  keys->reserve(count * c->keys.size);
+  values->reserve(count * c->values.size);
+  for_each_span(c, count, [&](const uint8_t* k, const uint8_t* v, uint64_t n) {
+    keys->insert(keys->end(), k, k + n * c->keys.size);
+    values->insert(values->end(), v, v + n * c->values.size);
+  });
+}
+
+}  // namespace radiance
+
+#endif  // SPANS__H